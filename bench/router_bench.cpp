@@ -0,0 +1,70 @@
+#include "http_router.hpp"
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+int main()
+{
+	static char const * const resources[] = {
+		"users", "orders", "products", "invoices", "carts", "sessions", "reviews", "tickets",
+		"projects", "builds", "artifacts", "deployments", "metrics", "alerts", "teams", "tokens",
+	};
+
+	http_router router;
+	std::vector<std::string> paths;
+
+	size_t route_count = 0;
+	for (int version = 1; version <= 8; ++version)
+	{
+		for (auto res : resources)
+		{
+			std::string base = "/api/v" + std::to_string(version) + "/" + res;
+
+			auto add = [&](char const * method, std::string const & pattern) {
+				router.add(method, pattern, [](request &&, route_params const &) {
+					return response(200);
+				});
+				++route_count;
+			};
+
+			add("GET", base);
+			add("POST", base);
+			add("GET", base + "/:id");
+			add("PUT", base + "/:id");
+			add("DELETE", base + "/:id");
+			add("GET", base + "/:id/history");
+			add("GET", base + "/:id/owners/:owner");
+			add("GET", base + "/search/*query");
+
+			paths.push_back(base);
+			paths.push_back(base + "/12345");
+			paths.push_back(base + "/12345/history");
+			paths.push_back(base + "/12345/owners/alice?verbose=1");
+			paths.push_back(base + "/search/a/b/c");
+		}
+	}
+
+	size_t const iterations = 2000;
+	size_t matched = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i != iterations; ++i)
+	{
+		for (auto const & path : paths)
+		{
+			route_params params;
+			if (router.match("GET", path, params))
+				++matched;
+		}
+	}
+	auto stop = std::chrono::steady_clock::now();
+
+	double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+	size_t lookups = iterations * paths.size();
+
+	std::cout << route_count << " routes, " << lookups << " lookups, "
+		<< matched << " matched, " << ns / lookups << " ns/lookup\n";
+
+	return matched == lookups? 0: 1;
+}
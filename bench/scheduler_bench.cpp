@@ -0,0 +1,178 @@
+#include "http2_scheduler.hpp"
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Simulates a page load over a link that carries one 16 KB DATA frame per
+// tick and reports when each class of resource starts and finishes.
+
+struct resource
+{
+	char const * kind;
+	http2_priority prio;
+	size_t size;
+
+	size_t sent;
+	size_t first_tick;
+	size_t done_tick;
+};
+
+static size_t const frame_size = 16384;
+
+static std::vector<resource> make_page()
+{
+	std::vector<resource> r;
+
+	auto add = [&](char const * kind, uint8_t urgency, bool incremental, size_t size, size_t count) {
+		for (size_t i = 0; i != count; ++i)
+		{
+			resource res = {};
+			res.kind = kind;
+			res.prio.urgency = urgency;
+			res.prio.incremental = incremental;
+			res.size = size;
+			r.push_back(res);
+		}
+	};
+
+	// Requested in an order that is typical for a browser that discovers
+	// the large resources first.
+	add("download", 7, true, 4 << 20, 1);
+	add("image", 5, true, 256 << 10, 16);
+	add("html", 0, false, 64 << 10, 1);
+	add("css/js", 1, false, 96 << 10, 6);
+	return r;
+}
+
+template <typename Next, typename Advance>
+static void simulate(std::vector<resource> & page, Next next, Advance advance)
+{
+	for (size_t tick = 1;; ++tick)
+	{
+		uint32_t id = next();
+		if (id == 0)
+			break;
+
+		resource & res = page[id / 2];
+		if (res.sent == 0)
+			res.first_tick = tick;
+
+		res.sent += (std::min)(frame_size, res.size - res.sent);
+		bool more = res.sent != res.size;
+		if (!more)
+			res.done_tick = tick;
+
+		advance(more);
+	}
+}
+
+// Jain's fairness index of the throughput of the resources of one kind,
+// 1 if all of them progressed at the same rate.
+static double fairness(std::vector<resource> const & page, std::string const & kind)
+{
+	double sum = 0;
+	double sum_sq = 0;
+	size_t n = 0;
+	for (auto const & res : page)
+	{
+		if (res.kind != kind)
+			continue;
+
+		double rate = double(res.size) / double(res.done_tick - res.first_tick + 1);
+		sum += rate;
+		sum_sq += rate * rate;
+		++n;
+	}
+
+	return n == 0? 0: sum * sum / (n * sum_sq);
+}
+
+static void report(char const * name, std::vector<resource> const & page)
+{
+	std::cout << name << "\n";
+	for (char const * kind : { "html", "css/js", "image", "download" })
+	{
+		size_t first = size_t(-1);
+		size_t last = 0;
+		for (auto const & res : page)
+		{
+			if (res.kind != std::string(kind))
+				continue;
+			first = (std::min)(first, res.first_tick);
+			last = (std::max)(last, res.done_tick);
+		}
+
+		std::cout << "  " << kind << ": first byte at " << first << ", complete at " << last << "\n";
+	}
+
+	std::cout << "  image fairness: " << fairness(page, "image") << "\n";
+}
+
+int main()
+{
+	{
+		std::vector<resource> page = make_page();
+		std::deque<uint32_t> queue;
+		for (size_t i = 0; i != page.size(); ++i)
+			queue.push_back(uint32_t(2 * i + 1));
+
+		simulate(page, [&] {
+			return queue.empty()? 0: queue.front();
+		}, [&](bool more) {
+			uint32_t id = queue.front();
+			queue.pop_front();
+			if (more)
+				queue.push_back(id);
+		});
+
+		report("round-robin", page);
+	}
+
+	{
+		std::vector<resource> page = make_page();
+		http2_scheduler sched;
+		for (size_t i = 0; i != page.size(); ++i)
+			sched.schedule(uint32_t(2 * i + 1), page[i].prio);
+
+		simulate(page, [&] {
+			return sched.next();
+		}, [&](bool more) {
+			sched.advance(more);
+		});
+
+		report("rfc 9218", page);
+	}
+
+	// The cost of a scheduling decision with many streams in flight.
+	{
+		size_t const streams = 256;
+		size_t const rounds = 20000;
+
+		http2_scheduler sched;
+		for (size_t i = 0; i != streams; ++i)
+		{
+			http2_priority prio;
+			prio.urgency = uint8_t(i % http2_priority::levels);
+			prio.incremental = (i & 1) != 0;
+			sched.schedule(uint32_t(2 * i + 1), prio);
+		}
+
+		size_t decisions = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i != rounds * streams; ++i)
+		{
+			if (sched.next() != 0)
+				++decisions;
+			sched.advance(true);
+		}
+		auto stop = std::chrono::steady_clock::now();
+
+		double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+		std::cout << streams << " streams, " << decisions << " decisions, " << ns / decisions << " ns/decision\n";
+	}
+
+	return 0;
+}
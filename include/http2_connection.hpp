@@ -0,0 +1,90 @@
+#ifndef HTTP2_CONNECTION_HPP
+#define HTTP2_CONNECTION_HPP
+
+#include "http_server.hpp"
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+
+// Thrown when the connection fails. A GOAWAY frame with the HTTP/2 error
+// code is queued before the exception is thrown, it should be written
+// before the transport is closed.
+struct http2_connection_error
+	: std::runtime_error
+{
+	explicit http2_connection_error(uint32_t code);
+
+	uint32_t code;
+};
+
+// The protocol state of a single HTTP/2 connection, without any I/O or
+// threads of its own.
+//
+// Bytes received from the client, starting with the connection preface,
+// are read into `input_buffer` and committed, or passed to `feed`. Requests
+// that become ready are taken with `next_request`, their bodies are read
+// with `read_body` and they may be answered with `submit_response` in any
+// order. The bytes to send are collected with `output` and removed with
+// `consume_output` once written.
+//
+// Connection errors are reported by exceptions thrown from `commit_input`.
+// The object must not be used from more than one thread at a time.
+struct http2_connection
+{
+	explicit http2_connection(http2_options const & opts = http2_options());
+	~http2_connection();
+
+	char * input_buffer(size_t & len);
+	void commit_input(size_t len);
+	void feed(char const * data, size_t len);
+
+	// Serves the request that upgraded the connection from HTTP/1.1 with
+	// `Upgrade: h2c` as stream 1. `settings` is the decoded HTTP2-Settings
+	// header. Must be called before any input is committed, the client
+	// still starts with the connection preface.
+	void upgrade(std::string_view settings, request const & req);
+
+	// The request refers to memory owned by the connection, it stays valid
+	// until the response is submitted.
+	bool next_request(uint32_t & stream_id, request & req);
+
+	// Reads the buffered part of a request body and releases the stream's
+	// flow control window by the amount read. Returns zero if nothing is
+	// buffered; more data may arrive with further input unless
+	// `body_complete` returns true.
+	size_t read_body(uint32_t stream_id, char * buf, size_t len);
+	bool body_complete(uint32_t stream_id) const;
+
+	// Returns true if the stream was reset by the client or because of
+	// a stream error. Its response is dropped when submitted.
+	bool stream_reset(uint32_t stream_id) const;
+
+	// Sends the response. The rest of the request body is discarded.
+	void submit_response(uint32_t stream_id, response resp);
+
+	// Resets the stream with INTERNAL_ERROR instead of answering it, or
+	// after its response failed part way.
+	void reset_stream(uint32_t stream_id);
+
+	// Starts a graceful shutdown. Requests that are already on their way
+	// are still served, new ones are refused. Once all of them are
+	// answered, the connection is finished.
+	void shutdown();
+	bool finished() const;
+
+	// The smoothed round trip time measured with PINGs while the client
+	// sends data, zero until the first measurement.
+	std::chrono::steady_clock::duration rtt() const;
+
+	// The buffers stay valid until they are consumed, even if more output
+	// is queued in the meantime.
+	bool has_output() const;
+	size_t output(std::string_view * bufs, size_t count) const;
+	void consume_output(size_t len);
+
+private:
+	struct impl;
+	std::unique_ptr<impl> pimpl_;
+};
+
+#endif // HTTP2_CONNECTION_HPP
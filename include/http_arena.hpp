@@ -0,0 +1,125 @@
+#ifndef HTTP_ARENA_HPP
+#define HTTP_ARENA_HPP
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// A monotonic allocator for memory that lives as long as a single request.
+//
+// Allocations are carved out of a chain of blocks and are only released by
+// `reset`. When a request needed more than the first block, `reset` replaces
+// the chain with a single block large enough for all of it, so that steady
+// keep-alive traffic is served without touching the heap.
+struct http_arena
+{
+	http_arena();
+	http_arena(void * buf, size_t size);
+	~http_arena();
+
+	http_arena(http_arena const &) = delete;
+	http_arena & operator=(http_arena const &) = delete;
+
+	void * allocate(size_t size, size_t align = alignof(std::max_align_t));
+	void reset();
+
+	template <typename T, typename... Args>
+	T * make(Args &&... args)
+	{
+		void * p = this->allocate(sizeof(T), alignof(T));
+		T * r = new(p) T(std::forward<Args>(args)...);
+		if (!std::is_trivially_destructible<T>::value)
+			this->add_finalizer(r, [](void * p) { static_cast<T *>(p)->~T(); });
+		return r;
+	}
+
+private:
+	struct block
+	{
+		block * next;
+		size_t size;
+	};
+
+	struct finalizer
+	{
+		finalizer * next;
+		void * obj;
+		void (*fn)(void *);
+	};
+
+	void add_finalizer(void * obj, void (*fn)(void *));
+	void run_finalizers();
+	void release_overflow();
+
+	char * cur_;
+	char * end_;
+
+	char * primary_;
+	size_t primary_size_;
+	bool primary_owned_;
+
+	block * overflow_;
+	finalizer * finalizers_;
+	size_t used_;
+};
+
+// Adapts `http_arena` for use with standard containers. A default
+// constructed allocator falls back to the global heap.
+template <typename T>
+struct arena_allocator
+{
+	typedef T value_type;
+	typedef std::true_type propagate_on_container_copy_assignment;
+	typedef std::true_type propagate_on_container_move_assignment;
+	typedef std::true_type propagate_on_container_swap;
+
+	arena_allocator() noexcept
+		: arena_(nullptr)
+	{
+	}
+
+	arena_allocator(http_arena * arena) noexcept
+		: arena_(arena)
+	{
+	}
+
+	template <typename U>
+	arena_allocator(arena_allocator<U> const & o) noexcept
+		: arena_(o.arena())
+	{
+	}
+
+	T * allocate(size_t n)
+	{
+		if (arena_)
+			return static_cast<T *>(arena_->allocate(n * sizeof(T), alignof(T)));
+		return static_cast<T *>(::operator new(n * sizeof(T)));
+	}
+
+	void deallocate(T * p, size_t) noexcept
+	{
+		if (!arena_)
+			::operator delete(p);
+	}
+
+	http_arena * arena() const noexcept
+	{
+		return arena_;
+	}
+
+	friend bool operator==(arena_allocator const & lhs, arena_allocator const & rhs) noexcept
+	{
+		return lhs.arena_ == rhs.arena_;
+	}
+
+	friend bool operator!=(arena_allocator const & lhs, arena_allocator const & rhs) noexcept
+	{
+		return lhs.arena_ != rhs.arena_;
+	}
+
+private:
+	http_arena * arena_;
+};
+
+#endif // HTTP_ARENA_HPP
@@ -0,0 +1,270 @@
+#ifndef HTTP_CORO_HPP
+#define HTTP_CORO_HPP
+
+#include "http_server.hpp"
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+template <typename T>
+struct task;
+
+namespace detail {
+
+struct task_promise_base
+{
+	std::coroutine_handle<> continuation;
+	std::exception_ptr error;
+
+	std::suspend_always initial_suspend() noexcept
+	{
+		return {};
+	}
+
+	struct final_awaiter
+	{
+		bool await_ready() noexcept
+		{
+			return false;
+		}
+
+		template <typename P>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+		{
+			if (auto c = h.promise().continuation)
+				return c;
+			return std::noop_coroutine();
+		}
+
+		void await_resume() noexcept
+		{
+		}
+	};
+
+	final_awaiter final_suspend() noexcept
+	{
+		return {};
+	}
+
+	void unhandled_exception() noexcept
+	{
+		error = std::current_exception();
+	}
+};
+
+template <typename T>
+struct task_promise
+	: task_promise_base
+{
+	alignas(T) unsigned char storage[sizeof(T)];
+	bool has_value = false;
+
+	~task_promise()
+	{
+		if (has_value)
+			reinterpret_cast<T *>(storage)->~T();
+	}
+
+	task<T> get_return_object() noexcept;
+
+	template <typename U>
+	void return_value(U && value)
+	{
+		new(storage) T(std::forward<U>(value));
+		has_value = true;
+	}
+
+	T get()
+	{
+		if (error)
+			std::rethrow_exception(error);
+		return std::move(*reinterpret_cast<T *>(storage));
+	}
+};
+
+template <>
+struct task_promise<void>
+	: task_promise_base
+{
+	task<void> get_return_object() noexcept;
+
+	void return_void() noexcept
+	{
+	}
+
+	void get()
+	{
+		if (error)
+			std::rethrow_exception(error);
+	}
+};
+
+}
+
+// A lazily started coroutine producing a value of type `T`. The coroutine
+// runs when the task is awaited and resumes the awaiter when it completes.
+template <typename T = void>
+struct task
+{
+	typedef detail::task_promise<T> promise_type;
+
+	task() noexcept
+		: h_(nullptr)
+	{
+	}
+
+	explicit task(std::coroutine_handle<promise_type> h) noexcept
+		: h_(h)
+	{
+	}
+
+	task(task && o) noexcept
+		: h_(std::exchange(o.h_, nullptr))
+	{
+	}
+
+	task & operator=(task && o) noexcept
+	{
+		std::swap(h_, o.h_);
+		return *this;
+	}
+
+	~task()
+	{
+		if (h_)
+			h_.destroy();
+	}
+
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+	{
+		h_.promise().continuation = awaiter;
+		return h_;
+	}
+
+	T await_resume()
+	{
+		return h_.promise().get();
+	}
+
+private:
+	std::coroutine_handle<promise_type> h_;
+};
+
+template <typename T>
+task<T> detail::task_promise<T>::get_return_object() noexcept
+{
+	return task<T>(std::coroutine_handle<task_promise>::from_promise(*this));
+}
+
+inline task<void> detail::task_promise<void>::get_return_object() noexcept
+{
+	return task<void>(std::coroutine_handle<task_promise>::from_promise(*this));
+}
+
+// Starts the task and lets it run to completion on its own. Exceptions
+// escaping the task are dropped.
+void spawn(task<void> t);
+
+// A non-blocking byte stream together with a readiness notification.
+//
+// `try_read` and `try_write` must never block; they return `would_block`
+// if no progress can be made. `wait_readable` and `wait_writable` arrange
+// for the coroutine to be resumed once the operation is worth retrying.
+struct async_io
+{
+	static size_t const would_block = size_t(-1);
+
+	virtual size_t try_read(char * buf, size_t len) = 0;
+	virtual size_t try_write(char const * buf, size_t len) = 0;
+	virtual size_t try_write_vec(std::string_view const * bufs, size_t count);
+
+	virtual void wait_readable(std::coroutine_handle<> h) = 0;
+	virtual void wait_writable(std::coroutine_handle<> h) = 0;
+
+	task<size_t> read(char * buf, size_t len);
+	task<void> write_all(char const * buf, size_t len);
+	task<void> write_all_vec(std::string_view * bufs, size_t count);
+
+protected:
+	~async_io() {}
+};
+
+struct async_istream
+{
+	virtual task<size_t> read(char * buf, size_t len) = 0;
+
+protected:
+	~async_istream() {}
+};
+
+struct co_request
+{
+	std::string_view method;
+	std::string_view path;
+	header_list headers;
+	async_istream * body = nullptr;
+	http_arena * arena = nullptr;
+};
+
+// Serves HTTP/1.1 requests on `io` until the peer closes the connection.
+// The handler may suspend, the connection is then parked until the handler
+// resumes and no thread is blocked in the meantime.
+task<void> co_http_server(async_io & io, std::function<task<response>(co_request &&)> fn);
+
+#ifndef _WIN32
+
+// A readiness-based I/O loop for non-blocking POSIX file descriptors.
+// Suspended coroutines are resumed from `run` on the calling thread, which
+// must be the only one running the reactor. Coroutines may wait for I/O,
+// and `post` and `stop` may be called, from any thread. `fd_io` does not
+// take ownership of the descriptor.
+struct io_reactor
+{
+	struct fd_io final
+		: async_io
+	{
+		fd_io(io_reactor & reactor, int fd);
+
+		size_t try_read(char * buf, size_t len) override;
+		size_t try_write(char const * buf, size_t len) override;
+		size_t try_write_vec(std::string_view const * bufs, size_t count) override;
+
+		void wait_readable(std::coroutine_handle<> h) override;
+		void wait_writable(std::coroutine_handle<> h) override;
+
+	private:
+		io_reactor & reactor_;
+		int fd_;
+	};
+
+	io_reactor();
+	~io_reactor();
+
+	// Accepts connections on the non-blocking listening socket `fd` and
+	// serves each of them with `co_http_server`. If accepting fails for
+	// other reasons than a lack of resources, the socket is no longer
+	// served and `run` throws the error.
+	void serve(int fd, std::function<task<response>(co_request &&)> fn);
+
+	void post(std::coroutine_handle<> h);
+
+	// Resumes the coroutine once the delay has passed.
+	void post(std::coroutine_handle<> h, std::chrono::steady_clock::duration delay);
+
+	void run();
+	void stop();
+
+private:
+	struct impl;
+	std::unique_ptr<impl> pimpl_;
+};
+
+#endif
+
+#endif // HTTP_CORO_HPP
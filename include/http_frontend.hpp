@@ -0,0 +1,28 @@
+#ifndef HTTP_FRONTEND_HPP
+#define HTTP_FRONTEND_HPP
+
+#include "http_server.hpp"
+
+struct http_frontend_options
+{
+	// Connections served over HTTP/2 use these options.
+	http2_options h2;
+
+	// Accepts a PROXY protocol header, version 1 or 2, in front of the
+	// connection. The addresses it carries are then available through
+	// `request::connection`. Only set this behind a proxy that always sends
+	// one, otherwise clients can claim any address they like.
+	bool accept_proxy = false;
+};
+
+// Serves a connection whose protocol is told from its first bytes, so that
+// a single port can serve them all. Connections that start with the HTTP/2
+// preface are served by `http2_server`, the rest by `http_server`, which
+// may still upgrade them to h2c. The bytes read to tell the protocol are
+// handed over to the server, not read again.
+//
+// libhttp has no TLS of its own, connections that start with a TLS
+// ClientHello are closed.
+void http_frontend(istream & in, ostream & out, std::function<response(request &&)> const & fn, http_frontend_options const & opts = http_frontend_options());
+
+#endif // HTTP_FRONTEND_HPP
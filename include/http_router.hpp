@@ -0,0 +1,120 @@
+#ifndef HTTP_ROUTER_HPP
+#define HTTP_ROUTER_HPP
+
+#include "http_server.hpp"
+#include <string>
+#include <vector>
+
+struct route_params
+{
+	enum { max_params = 8 };
+
+	route_params()
+		: size_(0)
+	{
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+	std::string_view name(size_t index) const
+	{
+		return names_[index];
+	}
+
+	std::string_view value(size_t index) const
+	{
+		return values_[index];
+	}
+
+	std::string_view operator[](std::string_view name) const
+	{
+		for (size_t i = 0; i != size_; ++i)
+		{
+			if (names_[i] == name)
+				return values_[i];
+		}
+
+		return {};
+	}
+
+	bool push(std::string_view name, std::string_view value)
+	{
+		if (size_ == max_params)
+			return false;
+
+		names_[size_] = name;
+		values_[size_] = value;
+		++size_;
+		return true;
+	}
+
+	void pop()
+	{
+		--size_;
+	}
+
+private:
+	std::string_view names_[max_params];
+	std::string_view values_[max_params];
+	size_t size_;
+};
+
+/**
+ * Routes requests to handlers by method and path.
+ *
+ * Patterns are matched segment-wise. A segment of the form `:name`
+ * matches a single non-empty path segment, `*name` must be the last
+ * segment and matches the rest of the path. Static segments are
+ * preferred over parameters, parameters over wildcards.
+ *
+ * Captured parameters are views into `request::path`, matching
+ * allocates no memory.
+ *
+ * Servers take their handler as a `std::function`, which would copy
+ * the whole router for each connection; pass it with `std::ref`.
+ */
+struct http_router
+{
+	typedef std::function<response(request &&, route_params const &)> handler;
+
+	http_router();
+
+	void add(std::string_view method, std::string_view pattern, handler h);
+
+	handler const * match(std::string_view method, std::string_view path, route_params & params) const;
+	response operator()(request && req) const;
+
+private:
+	enum { method_count = 9 };
+	static uint32_t const npos = uint32_t(-1);
+
+	struct node
+	{
+		std::string prefix;
+		std::string child_keys;
+		std::vector<uint32_t> children;
+		uint32_t param_child;
+		uint32_t wildcard_child;
+		std::string param_name;
+
+		uint32_t methods[method_count];
+		std::vector<std::pair<std::string, uint32_t>> other_methods;
+		bool terminal;
+
+		node();
+	};
+
+	uint32_t insert_static(uint32_t idx, std::string_view text);
+	uint32_t insert_param(uint32_t idx, std::string_view name, bool wildcard);
+	uint32_t find_method(node const & n, std::string_view method) const;
+	uint32_t match_path(std::string_view path, route_params & params) const;
+	uint32_t match_node(uint32_t idx, std::string_view path, route_params & params) const;
+
+	std::vector<node> nodes_;
+	std::vector<handler> handlers_;
+};
+
+#endif // HTTP_ROUTER_HPP
@@ -2,6 +2,8 @@
 #define HTTP_SERVER_HPP
 
 #include "stream.hpp"
+#include "http_arena.hpp"
+#include "http_stop_token.hpp"
 #include <string_view>
 #include <vector>
 #include <memory>
@@ -14,7 +16,7 @@ struct header_view
 	std::string_view name;
 	std::string_view value;
 
-	bool operator<(header_view const & rhs)
+	bool operator<(header_view const & rhs) const
 	{
 		return compare_header_name(name, rhs.name) < 0;
 	}
@@ -46,7 +48,7 @@ struct header
 	}
 };
 
-using header_list = std::vector<header_view>;
+using header_list = std::vector<header_view, arena_allocator<header_view>>;
 
 std::pair<header_view const *, header_view const *> get_header_range(header_list const & headers, std::string_view name);
 std::string_view const * get_single(header_list const & headers, std::string_view name);
@@ -73,7 +75,7 @@ struct enum_headers
 		friend bool operator==(const_iterator const & lhs, const_iterator const & rhs)
 		{
 			return (lhs.self_ == rhs.self_)
-				|| ((lhs.self_ == nullptr || lhs.self_->empty()) == (rhs.self_ == nullptr && rhs.self_->empty()));
+				|| ((lhs.self_ == nullptr || lhs.self_->empty()) == (rhs.self_ == nullptr || rhs.self_->empty()));
 		}
 
 		friend bool operator!=(const_iterator const & lhs, const_iterator const & rhs)
@@ -93,7 +95,7 @@ struct enum_headers
 
 	bool empty() const
 	{
-		return first_ != last_;
+		return first_ == last_;
 	}
 
 	std::string_view front() const
@@ -123,12 +125,190 @@ private:
 	header_view const * last_;
 };
 
+// An output stream that can write several buffers with a single call.
+// Response bodies held in memory are sent this way together with
+// the response head, without being copied.
+struct vectored_ostream
+	: ostream
+{
+	virtual size_t write_vec(std::string_view const * bufs, size_t count) = 0;
+};
+
+// The body of a request or a response.
+//
+// A body either refers to a stream it doesn't own, owns a string (stored
+// inline when it is short), refers to a list of buffers kept alive by
+// an owner, or shares ownership of a stream. In-memory bodies expose their
+// contents through `slices` so that they can be written out directly.
+// Shared streams are the only kind that allocate a control block; use them
+// for bodies that must outlive the handler. The members of the different
+// kinds share storage, an inline string takes the place of an owned one.
+struct http_body
+{
+	// The size of a body whose length is not known in advance.
+	static constexpr uint64_t unknown_size = uint64_t(-1);
+
+	enum { inline_capacity = sizeof(std::string) };
+
+	http_body() noexcept;
+	http_body(std::nullptr_t) noexcept;
+	http_body(istream & stream) noexcept;
+	http_body(std::shared_ptr<istream> stream) noexcept;
+	explicit http_body(std::string_view str);
+	explicit http_body(std::string && str);
+	http_body(std::vector<std::string_view> slices, std::shared_ptr<void> owner);
+
+	// Returns the number of unread bytes of an in-memory body,
+	// or `unknown_size` for streams.
+	uint64_t size() const noexcept;
+
+	// Returns the unread contents of an in-memory body, or null for streams.
+	std::string_view const * slices(size_t & count) const noexcept;
+
+	http_body(http_body && o) noexcept;
+	http_body & operator=(http_body && o) noexcept;
+	~http_body();
+
+	istream * get() const noexcept
+	{
+		return stream_;
+	}
+
+	istream * operator->() const noexcept
+	{
+		return stream_;
+	}
+
+	istream & operator*() const noexcept
+	{
+		return *stream_;
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return stream_ != nullptr;
+	}
+
+	friend bool operator==(http_body const & lhs, std::nullptr_t) noexcept
+	{
+		return lhs.stream_ == nullptr;
+	}
+
+	friend bool operator!=(http_body const & lhs, std::nullptr_t) noexcept
+	{
+		return lhs.stream_ != nullptr;
+	}
+
+private:
+	struct memory_istream final
+		: istream
+	{
+		std::string_view * cur;
+		std::string_view * last;
+
+		size_t read(char * buf, size_t len) override;
+	};
+
+	// In-memory bodies are read through `mem`, which walks the slices
+	// that are left.
+	struct owned_body
+	{
+		memory_istream mem;
+		std::string_view single;
+		std::string str;
+	};
+
+	struct inline_body
+	{
+		memory_istream mem;
+		std::string_view single;
+		char data[inline_capacity];
+	};
+
+	struct rope_body
+	{
+		memory_istream mem;
+		std::vector<std::string_view> slices;
+		std::shared_ptr<void> owner;
+	};
+
+	enum class kind : uint8_t
+	{
+		empty,
+		borrowed,
+		shared,
+		inline_string,
+		owned_string,
+		rope,
+	};
+
+	void set_inline(char const * data, size_t size) noexcept;
+	void set_owned(std::string && str, size_t offset, size_t size) noexcept;
+	void set_rope(std::vector<std::string_view> && slices, size_t first, std::shared_ptr<void> && owner) noexcept;
+	void move_from(http_body && o) noexcept;
+	void destroy() noexcept;
+
+	kind kind_;
+	istream * stream_;
+
+	// Only the member that belongs to `kind_` is alive.
+	union
+	{
+		std::shared_ptr<istream> shared_;
+		owned_body owned_;
+		inline_body inline_;
+		rope_body rope_;
+	};
+};
+
+struct http_address
+{
+	enum class kind : uint8_t
+	{
+		unspecified,
+		ipv4,
+		ipv6,
+		unix_socket,
+	};
+
+	kind family = kind::unspecified;
+
+	// In network byte order, an IPv4 address takes the first four bytes.
+	uint8_t ip[16] = {};
+	uint16_t port = 0;
+};
+
+// What is known about the connection a request arrived on, the same for
+// all of the connection's requests.
+struct http_connection_info
+{
+	// The client and the address it connected to as reported by a PROXY
+	// protocol header. Unspecified if the proxy didn't know them.
+	http_address source;
+	http_address destination;
+
+	// The fields of a PROXY v2 header, empty if not sent.
+	std::string alpn;
+	std::string authority;
+	std::string unique_id;
+
+	// Set if the client connected to the proxy over TLS.
+	bool tls = false;
+	std::string tls_version;
+};
+
 struct request
 {
 	std::string_view method;
 	std::string_view path;
 	header_list headers;
-	std::shared_ptr<istream> body;
+	http_body body;
+
+	// Scratch memory released once the response is sent, may be null.
+	http_arena * arena = nullptr;
+
+	// Null unless the connection started with a PROXY protocol header.
+	http_connection_info const * connection = nullptr;
 };
 
 struct response
@@ -138,50 +318,116 @@ struct response
 	std::vector<header> headers;
 
 	uint64_t content_length;
-	std::shared_ptr<istream> body;
+	http_body body;
 
 	response(uint16_t status_code, std::initializer_list<header> headers = {})
 		: status_code(status_code), headers(headers), content_length(0)
 	{
 	}
 
+	response(http_body body, std::initializer_list<header> headers, uint16_t status_code = 200)
+		: status_code(status_code), headers(headers), content_length(body.size()), body(std::move(body))
+	{
+	}
+
 	response(std::shared_ptr<istream> body, std::initializer_list<header> headers, uint16_t status_code = 200)
-		: status_code(status_code), headers(headers), content_length(uint64_t(-1)), body(body)
+		: response(http_body(std::move(body)), headers, status_code)
 	{
 	}
 
 	response(std::string body, std::initializer_list<header> headers = {{ "content-type", "text/plain" }}, uint16_t status_code = 200)
-		: status_code(status_code), headers(headers), content_length(body.size())
+		: status_code(status_code), headers(headers), content_length(body.size()), body(std::move(body))
 	{
-		struct x
-		{
-			std::string str_;
-			string_istream ss_;
-
-			explicit x(std::string && str)
-				: str_(std::move(str)), ss_(str_)
-			{
-			}
-		};
-
-		auto px = std::make_shared<x>(std::move(body));
-		this->body = std::shared_ptr<istream>(px, &px->ss_);
 	}
 
 	response(std::string_view body, std::initializer_list<header> headers = {{ "content-type", "text/plain" }}, uint16_t status_code = 200)
-		: response(std::string(body), headers, status_code)
+		: status_code(status_code), headers(headers), content_length(body.size()), body(body)
 	{
 	}
 
 	response(char const * body, std::initializer_list<header> headers = {{ "content-type", "text/plain" }}, uint16_t status_code = 200)
-		: response(std::string(body), headers, status_code)
+		: response(std::string_view(body), headers, status_code)
 	{
 	}
 };
 
 response http_abort(uint16_t status_code);
 
-void http_server(istream & in, ostream & out, std::function<response(request &&)> const & fn);
-void http2_server(istream & in, ostream & out, std::function<response(request &&)> const & fn);
+struct http_worker_pool;
+
+struct http2_options
+{
+	// The SETTINGS_MAX_FRAME_SIZE advertised to the client, between 16384
+	// and 16777215. Larger frames reduce per-frame overhead of bulk uploads.
+	uint32_t max_frame_size = 16384;
+
+	// Limits the size of a compressed header block, including all of its
+	// CONTINUATION frames.
+	uint32_t max_header_block_size = 64 * 1024;
+
+	// The SETTINGS_MAX_CONCURRENT_STREAMS advertised to the client. Streams
+	// beyond the limit are refused.
+	uint32_t max_concurrent_streams = 100;
+
+	// The SETTINGS_INITIAL_WINDOW_SIZE advertised to the client, also the
+	// initial size of the connection window.
+	uint32_t initial_window_size = 65535;
+
+	// While the client uploads, the receive windows grow toward the measured
+	// bandwidth-delay product, but not beyond this size; a window limits
+	// throughput to window / RTT. Set to `initial_window_size` to turn the
+	// growth off.
+	//
+	// A stream may buffer up to a window of request body its handler hasn't
+	// read yet, so that the streams of a connection could buffer up to
+	// `max_concurrent_streams * max_window_size`, 100 MB by default, if it
+	// weren't for `max_buffered_body`.
+	uint32_t max_window_size = 1024 * 1024;
+
+	// Limits the request body a connection buffers for all of its streams.
+	// Beyond it, the connection window is only released as handlers read,
+	// so a connection buffers at most this plus a connection window. If a
+	// handler waits for its body while the limit is held up by requests
+	// that are yet to be handled, these are refused and the client retries
+	// them.
+	uint32_t max_buffered_body = 4 * 1024 * 1024;
+
+	// The SETTINGS_HEADER_TABLE_SIZE advertised to the client, the size of
+	// the dynamic table used to decode request headers.
+	uint32_t header_table_size = 4096;
+
+	// The SETTINGS_MAX_HEADER_LIST_SIZE advertised to the client. Requests
+	// with larger headers are answered with 431.
+	uint32_t max_header_list_size = 64 * 1024;
+
+	// Limits the frames that make the server work without moving a request
+	// forward: PING, SETTINGS, PRIORITY, PRIORITY_UPDATE and empty DATA
+	// frames. They are allowed in bursts of `max_control_burst`, refilled at
+	// `max_control_rate` per second. A client over the limit is disconnected
+	// with ENHANCE_YOUR_CALM.
+	uint32_t max_control_burst = 1000;
+	uint32_t max_control_rate = 100;
+
+	// Limits the streams that are reset before they are answered, be it by
+	// the client or because of a stream error, in the same way.
+	uint32_t max_reset_burst = 1000;
+	uint32_t max_reset_rate = 100;
+
+	// Runs the handlers of the connection's streams in parallel. Without
+	// a pool, the handlers are run one at a time on the connection's thread.
+	http_worker_pool * pool = nullptr;
+
+	// Requests a graceful shutdown of the connection: the client is told
+	// with GOAWAY not to open more streams and the connection closes once
+	// the streams in flight are answered.
+	http_stop_token stop;
+};
+
+void http2_server(istream & in, ostream & out, std::function<response(request &&)> const & fn, http2_options const & opts = http2_options());
+
+// Serves HTTP/1.1 requests. A connection that starts with the HTTP/2
+// preface, or that is upgraded with `Upgrade: h2c`, is served as HTTP/2
+// with `h2opts` instead.
+void http_server(istream & in, ostream & out, std::function<response(request &&)> const & fn, http2_options const & h2opts = http2_options());
 
 #endif // HTTP_SERVER_HPP
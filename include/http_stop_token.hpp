@@ -0,0 +1,58 @@
+#ifndef HTTP_STOP_TOKEN_HPP
+#define HTTP_STOP_TOKEN_HPP
+
+#include <functional>
+#include <memory>
+
+// A request to stop that is made from one thread and observed by others,
+// modelled after `std::stop_source` and `std::stop_token`.
+//
+// A default-constructed token is never stopped.
+struct http_stop_token
+{
+	http_stop_token() noexcept;
+	bool stop_requested() const noexcept;
+
+private:
+	struct state;
+	explicit http_stop_token(std::shared_ptr<state> st) noexcept;
+
+	std::shared_ptr<state> state_;
+
+	friend struct http_stop_source;
+	friend struct http_stop_callback;
+};
+
+struct http_stop_source
+{
+	http_stop_source();
+
+	http_stop_token token() const noexcept;
+	bool stop_requested() const noexcept;
+
+	// Runs the registered callbacks on the calling thread, one at a time.
+	// Callbacks may be registered and unregistered by other threads in the
+	// meantime. Only the first call has any effect.
+	void request_stop();
+
+private:
+	std::shared_ptr<http_stop_token::state> state_;
+};
+
+// Registers a callback that is called when a stop is requested, or right
+// away if it already was. The destructor waits for a running callback to
+// return, so callbacks should not block for long.
+struct http_stop_callback
+{
+	http_stop_callback(http_stop_token const & token, std::function<void()> fn);
+	~http_stop_callback();
+
+	http_stop_callback(http_stop_callback const &) = delete;
+	http_stop_callback & operator=(http_stop_callback const &) = delete;
+
+private:
+	std::shared_ptr<http_stop_token::state> state_;
+	std::function<void()> fn_;
+};
+
+#endif // HTTP_STOP_TOKEN_HPP
@@ -0,0 +1,54 @@
+#ifndef HTTP_WORKER_POOL_HPP
+#define HTTP_WORKER_POOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads that run posted tasks.
+//
+// Every worker has its own queue. Tasks posted from a worker go to its own
+// queue and are run most recent first, which keeps their data in the
+// worker's cache; tasks posted from elsewhere are spread over the queues.
+// An idle worker steals the oldest task of another queue.
+//
+// The pool may be shared by any number of connections. The destructor runs
+// the tasks that are still queued and joins the threads.
+struct http_worker_pool
+{
+	// Zero threads means one per hardware thread.
+	explicit http_worker_pool(size_t threads = 0);
+	~http_worker_pool();
+
+	http_worker_pool(http_worker_pool const &) = delete;
+	http_worker_pool & operator=(http_worker_pool const &) = delete;
+
+	// Queues a task. Exceptions escaping the task are ignored.
+	void post(std::function<void()> task);
+
+private:
+	struct worker
+	{
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+		std::thread thread;
+	};
+
+	bool take(size_t self, std::function<void()> & task);
+	void run(size_t self);
+
+	std::vector<std::unique_ptr<worker>> workers_;
+
+	// The number of queued tasks not yet claimed by a worker.
+	std::mutex mutex_;
+	std::condition_variable ready_;
+	size_t pending_;
+	size_t next_queue_;
+	bool stopping_;
+};
+
+#endif // HTTP_WORKER_POOL_HPP
@@ -1,5 +1,10 @@
 #include "hpack.hpp"
 #include "hpack_unhuff.hpp"
+#include "hpack_huff.hpp"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <limits>
 
 static header_view const g_static_table[] = {
 	{ ":authority" },
@@ -67,252 +72,386 @@ static header_view const g_static_table[] = {
 
 static size_t const g_static_table_size = sizeof(g_static_table) / sizeof(g_static_table[0]);
 
-hpack_dynamic_table::hpack_dynamic_table()
-	: table_size_(0), table_capacity_(0)
+hpack_dynamic_table::hpack_dynamic_table(size_t capacity)
+	: data_size_(0), tail_(0), first_(0), count_(0), table_size_(0), table_capacity_(0)
 {
+	this->resize(capacity);
 }
 
 void hpack_dynamic_table::resize(size_t capacity)
 {
-	// XXX
-}
+	this->evict(capacity);
+	table_capacity_ = capacity;
 
-size_t hpack_dynamic_table::size() const
-{
-	return table_.size();
+	if (capacity * 2 > data_size_)
+		this->reserve(capacity);
 }
 
 header_view hpack_dynamic_table::operator[](size_t index) const
 {
-	auto && e = table_[index];
-	return{ e.name, e.value };
+	entry const & e = entries_[(first_ + count_ - 1 - index) % entries_.size()];
+	char const * p = data_.get() + e.pos % data_size_;
+	return{ { p, e.name_size }, { p + e.name_size, e.value_size } };
 }
 
-void hpack_dynamic_table::add(std::string name, std::string value)
+void hpack_dynamic_table::add(std::string_view name, std::string_view value)
 {
-	size_t new_entry_size = name.size() + value.size() + 32;
-	if (new_entry_size > table_capacity_)
+	size_t len = name.size() + value.size();
+	if (len + 32 > table_capacity_)
 	{
-		table_size_ = 0;
-		table_.clear();
+		this->evict(0);
 		return;
 	}
 
-	table_.push_back({ std::move(name), std::move(value) });
-	table_size_ += new_entry_size;
+	// The entry the strings refer to may be evicted and overwritten.
+	auto in_table = [this](std::string_view str) {
+		std::less<char const *> less;
+		return !less(str.data(), data_.get()) && less(str.data(), data_.get() + data_size_);
+	};
 
-	while (table_size_ > table_capacity_)
+	if (in_table(name) || in_table(value))
 	{
-		auto && e = table_.front();
-		table_size_ -= e.name.size() + e.value.size() + 32;
-		table_.pop_front();
+		scratch_.assign(name.data(), name.size());
+		scratch_.append(value.data(), value.size());
+		name = std::string_view(scratch_.data(), name.size());
+		value = std::string_view(scratch_.data() + name.size(), value.size());
 	}
+
+	this->evict(table_capacity_ - len - 32);
+
+	// The live entries take at most the capacity and the space skipped at
+	// the end of the buffer is smaller than an entry, so the new one fits.
+	size_t offset = tail_ % data_size_;
+	if (data_size_ - offset < len)
+		tail_ += data_size_ - offset;
+
+	char * p = data_.get() + tail_ % data_size_;
+	p = std::copy(name.begin(), name.end(), p);
+	std::copy(value.begin(), value.end(), p);
+
+	entries_[(first_ + count_) % entries_.size()] = { tail_, uint32_t(name.size()), uint32_t(value.size()) };
+	++count_;
+	tail_ += len;
+	table_size_ += len + 32;
 }
 
-hpack_decoder::hpack_decoder(size_t max_cap)
-	: table_max_capacity_(max_cap)
+void hpack_dynamic_table::evict(size_t capacity)
 {
+	while (table_size_ > capacity)
+	{
+		entry const & e = entries_[first_];
+		table_size_ -= e.name_size + e.value_size + 32;
+		first_ = (first_ + 1) % entries_.size();
+		--count_;
+	}
 }
 
-template <int prefix_len, typename Integral>
-static char const * read_int(Integral & val, char const * first, char const * last)
+// Moves the entries to larger buffers, the oldest one first.
+void hpack_dynamic_table::reserve(size_t capacity)
 {
-	// XXX: handle overflows
+	size_t data_size = capacity * 2;
+	std::unique_ptr<char[]> data(new char[data_size]);
+
+	// Every entry takes at least 32 octets of the capacity.
+	std::vector<entry> entries(capacity / 32);
 
+	uint64_t pos = 0;
+	for (size_t i = 0; i != count_; ++i)
+	{
+		entry e = entries_[(first_ + i) % entries_.size()];
+		char const * p = data_.get() + e.pos % data_size_;
+		std::copy(p, p + e.name_size + e.value_size, data.get() + pos);
+
+		e.pos = pos;
+		pos += e.name_size + e.value_size;
+		entries[i] = e;
+	}
+
+	data_ = std::move(data);
+	data_size_ = data_size;
+	entries_ = std::move(entries);
+	first_ = 0;
+	tail_ = pos;
+}
+
+hpack_decoder::hpack_decoder(size_t max_cap, size_t max_list_size)
+	: dynamic_table_(max_cap), table_max_capacity_(max_cap), list_size_(0), max_list_size_(max_list_size), in_block_(false)
+{
+}
+
+template <int prefix_len, typename Integral>
+static hpack_result read_int(Integral & val, char const *& first, char const * last)
+{
 	static uint8_t const mask = (1<<prefix_len) - 1;
 
 	if (first == last)
-		return nullptr;
+		return hpack_result::incomplete;
 
-	uint8_t prefix = *first++ & mask;
+	char const * cur = first;
+	uint8_t prefix = *cur++ & mask;
 	if (prefix != mask)
 	{
 		val = prefix;
-		return first;
+		first = cur;
+		return hpack_result::ok;
 	}
 
-	Integral r = 0;
-	while (first != last)
+	uint64_t r = mask;
+	for (int shift = 0; cur != last; shift += 7)
 	{
-		uint8_t ch = *first++;
+		// Continuation bytes may add nothing, bound their number so that
+		// the shift stays within 64 bits.
+		if (shift > 56)
+			return hpack_result::invalid;
 
-		r = (r << 7) | (ch & 0x7f);
+		uint8_t ch = *cur++;
+
+		r += uint64_t(ch & 0x7f) << shift;
+		if (r > std::numeric_limits<Integral>::max())
+			return hpack_result::invalid;
 
 		if ((ch & 0x80) == 0)
 		{
-			val = r + mask;
-			return first;
+			val = Integral(r);
+			first = cur;
+			return hpack_result::ok;
 		}
 	}
 
-	return nullptr;
+	return hpack_result::incomplete;
 }
 
-static char const * read_string(std::string & str, char const * first, char const * last)
+static std::string_view copy_string(http_arena & arena, std::string_view str)
+{
+	if (str.empty())
+		return {};
+
+	char * p = static_cast<char *>(arena.allocate(str.size(), 1));
+	memcpy(p, str.data(), str.size());
+	return { p, str.size() };
+}
+
+// Reads a string literal into the arena.
+static hpack_result read_string(std::string_view & str, char const *& first, char const * last, http_arena & arena)
 {
 	if (first == last)
-		return nullptr;
+		return hpack_result::incomplete;
 
 	bool huffman = (*first & 0x80) != 0;
 
+	char const * cur = first;
 	uint32_t len;
-	first = read_int<7>(len, first, last);
-	if (!first)
-		return nullptr;
+	hpack_result r = read_int<7>(len, cur, last);
+	if (r != hpack_result::ok)
+		return r;
 
-	if (last - first < len)
-		return nullptr;
+	if (size_t(last - cur) < len)
+		return hpack_result::incomplete;
 
-	last = first + len;
+	last = cur + len;
 
 	if (!huffman)
 	{
-		str.assign(first, len);
-		return last;
+		str = copy_string(arena, { cur, len });
+		first = last;
+		return hpack_result::ok;
 	}
 
-	str.clear();
+	// The shortest code has five bits. A table entry stores all of its
+	// symbols even if it decodes fewer, the output has room for them.
+	char * out = len != 0? static_cast<char *>(arena.allocate(size_t(len) * 8 / 5 + hpack_unhuff_max_symbols, 1)): nullptr;
+	size_t out_len = 0;
 
 	uint8_t flags = hpack_unhuff_entry::valid | hpack_unhuff_entry::last;
 	uint8_t state = 0;
 
-	auto decode_one = [&](uint8_t value) {
-		auto && entry = g_hpack_unhuff_table[state][value];
+	while (cur != last)
+	{
+		uint8_t ch = *cur++;
+		for (int shift = 8 - hpack_unhuff_bits; shift >= 0; shift -= hpack_unhuff_bits)
+		{
+			auto && entry = g_hpack_unhuff_table[state][(ch >> shift) & ((1 << hpack_unhuff_bits) - 1)];
 
-		state = entry.next_state;
-		flags = entry.flags;
-		if (flags & hpack_unhuff_entry::decodes)
-			str.push_back(entry.value);
+			flags = entry.flags;
+			if ((flags & hpack_unhuff_entry::valid) == 0)
+				return hpack_result::invalid;
 
-		return flags & hpack_unhuff_entry::valid;
-	};
+			state = entry.next_state;
+			for (int i = 0; i != hpack_unhuff_max_symbols; ++i)
+				out[out_len + i] = entry.values[i];
+			out_len += flags >> hpack_unhuff_entry::count_shift;
+		}
+	}
+
+	if ((flags & hpack_unhuff_entry::last) == 0)
+		return hpack_result::invalid;
 
+	str = { out, out_len };
+	first = last;
+	return hpack_result::ok;
+}
+
+bool hpack_decoder::decode(header_list & headers, std::string_view buf, bool end_of_block, http_arena & arena)
+{
+	char const * first = buf.begin();
+	char const * last = buf.end();
+
+	if (!in_block_)
+	{
+		list_size_ = 0;
+		in_block_ = true;
+	}
+
+	if (end_of_block)
+		in_block_ = false;
+
+	// The tail of the previous fragment is completed from this one.
+	if (!partial_.empty())
+	{
+		partial_.append(first, last);
+		joined_.swap(partial_);
+		partial_.clear();
+
+		first = joined_.data();
+		last = first + joined_.size();
+	}
 
 	while (first != last)
 	{
-		uint8_t ch = *first++;
-		if (!decode_one(ch >> 4) || !decode_one(ch & 0xf))
-			return nullptr;
+		hpack_result r = this->decode_field(headers, first, last, arena);
+		if (r == hpack_result::invalid)
+			return false;
+		if (r == hpack_result::incomplete)
+			break;
 	}
 
-	if (flags & hpack_unhuff_entry::last)
-		return last;
+	if (first != last)
+	{
+		if (end_of_block)
+			return false;
+		partial_.assign(first, last);
+	}
 
-	return nullptr;
+	return true;
 }
 
-bool hpack_decoder::decode(std::vector<header> & headers, std::string_view buf)
+// Adds a field to the list unless the list is too large. Strings taken
+// from the dynamic table are copied, the entry may be evicted while
+// the field is still in use.
+void hpack_decoder::emit(header_list & headers, header_view hv, bool copy_name, bool copy_value, http_arena & arena)
 {
-	char const * first = buf.begin();
-	char const * last = buf.end();
+	list_size_ += hv.name.size() + hv.value.size() + 32;
+	if (list_size_ > max_list_size_)
+		return;
 
-	auto getch = [&] {
-		uint8_t r = (uint8_t)buf[0];
-		buf.remove_prefix(1);
-		return r;
-	};
+	if (copy_name)
+		hv.name = copy_string(arena, hv.name);
+	if (copy_value)
+		hv.value = copy_string(arena, hv.value);
+	headers.push_back(hv);
+}
 
-	while (first != last)
+// Decodes a single field representation, `first` is only advanced
+// if the whole representation is available.
+hpack_result hpack_decoder::decode_field(header_list & headers, char const *& first, char const * last, http_arena & arena)
+{
+	char const * cur = first;
+	hpack_result r;
+
+	if (*cur & 0x80)
 	{
-		if (*first & 0x80)
+		uint32_t idx = 0;
+		if ((r = read_int<7>(idx, cur, last)) != hpack_result::ok)
+			return r;
+
+		if (idx == 0 || idx > this->entry_count())
+			return hpack_result::invalid;
+
+		bool dynamic = idx > g_static_table_size;
+		this->emit(headers, this->get_entry(idx), dynamic, dynamic, arena);
+	}
+	else if (*cur & 0x40)
+	{
+		uint32_t idx = 0;
+		if ((r = read_int<6>(idx, cur, last)) != hpack_result::ok)
+			return r;
+
+		if (idx > this->entry_count())
+			return hpack_result::invalid;
+
+		if (idx != 0)
 		{
-			uint32_t idx = 0;
-			first = read_int<7>(idx, first, last);
-			if (!first)
-				return false;
+			std::string_view value;
+			if ((r = read_string(value, cur, last, arena)) != hpack_result::ok)
+				return r;
 
-			if (idx == 0 || idx > this->entry_count())
-				return false;
+			header_view hv = this->get_entry(idx);
+			hv.value = value;
+			this->emit(headers, hv, idx > g_static_table_size, false, arena);
 
-			headers.push_back(this->get_entry(idx));
+			// The entry the name refers to may be evicted by the addition.
+			dynamic_table_.add(hv.name, value);
 		}
-		else if (*first & 0x40)
+		else
 		{
-			uint32_t idx = 0;
-			first = read_int<6>(idx, first, last);
-			if (!first)
-				return false;
-
-			if (idx > this->entry_count())
-				return false;
-
-			if (idx != 0)
-			{
-				std::string value;
-				first = read_string(value, first, last);
-				if (!first)
-					return false;
-
-				header_view hv = this->get_entry(idx);
-				dynamic_table_.add(hv.name, value);
-				headers.push_back({ hv.name, std::move(value) });
-			}
-			else
-			{
-				std::string name;
-				first = read_string(name, first, last);
-				if (!first)
-					return false;
-
-				std::string value;
-				first = read_string(value, first, last);
-				if (!first)
-					return false;
-
-				dynamic_table_.add(name, value);
-				headers.push_back({ std::move(name), std::move(value) });
-			}
+			std::string_view name;
+			if ((r = read_string(name, cur, last, arena)) != hpack_result::ok)
+				return r;
+
+			std::string_view value;
+			if ((r = read_string(value, cur, last, arena)) != hpack_result::ok)
+				return r;
+
+			dynamic_table_.add(name, value);
+			this->emit(headers, { name, value }, false, false, arena);
 		}
-		else if (*first & 0x20)
-		{
-			uint32_t cap = 0;
-			first = read_int<6>(cap, first, last);
-			if (!first)
-				return false;
+	}
+	else if (*cur & 0x20)
+	{
+		uint32_t cap = 0;
+		if ((r = read_int<5>(cap, cur, last)) != hpack_result::ok)
+			return r;
 
-			if (cap > table_max_capacity_)
-				return false;
+		if (cap > table_max_capacity_)
+			return hpack_result::invalid;
 
-			dynamic_table_.resize(cap);
+		dynamic_table_.resize(cap);
+	}
+	else
+	{
+		uint32_t idx;
+		if ((r = read_int<4>(idx, cur, last)) != hpack_result::ok)
+			return r;
+
+		if (idx > this->entry_count())
+			return hpack_result::invalid;
+
+		if (idx != 0)
+		{
+			std::string_view value;
+			if ((r = read_string(value, cur, last, arena)) != hpack_result::ok)
+				return r;
+
+			header_view hv = this->get_entry(idx);
+			hv.value = value;
+			this->emit(headers, hv, idx > g_static_table_size, false, arena);
 		}
 		else
 		{
-			uint32_t idx;
-			first = read_int<4>(idx, first, last);
-			if (!first)
-				return false;
-
-			if (idx > this->entry_count())
-				return false;
-
-			if (idx != 0)
-			{
-				std::string value;
-				first = read_string(value, first, last);
-				if (!first)
-					return false;
-
-				header_view hv = this->get_entry(idx);
-				headers.push_back({ hv.name, std::move(value) });
-			}
-			else
-			{
-				std::string name;
-				first = read_string(name, first, last);
-				if (!first)
-					return false;
-
-				std::string value;
-				first = read_string(value, first, last);
-				if (!first)
-					return false;
-
-				headers.push_back({ std::move(name), std::move(value) });
-			}
+			std::string_view name;
+			if ((r = read_string(name, cur, last, arena)) != hpack_result::ok)
+				return r;
+
+			std::string_view value;
+			if ((r = read_string(value, cur, last, arena)) != hpack_result::ok)
+				return r;
+
+			this->emit(headers, { name, value }, false, false, arena);
 		}
 	}
 
-	return true;
+	first = cur;
+	return hpack_result::ok;
 }
 
 size_t hpack_decoder::entry_count() const
@@ -327,3 +466,260 @@ header_view hpack_decoder::get_entry(size_t index) const
 	else
 		return g_static_table[index - 1];
 }
+
+template <int prefix_len>
+static void write_int(std::string & out, uint8_t flags, uint32_t value)
+{
+	static uint8_t const mask = (1<<prefix_len) - 1;
+
+	if (value < mask)
+	{
+		out.push_back(char(flags | value));
+		return;
+	}
+
+	out.push_back(char(flags | mask));
+	value -= mask;
+	while (value >= 0x80)
+	{
+		out.push_back(char(0x80 | (value & 0x7f)));
+		value >>= 7;
+	}
+	out.push_back(char(value));
+}
+
+static void write_string(std::string & out, std::string_view str)
+{
+	uint64_t bits = 0;
+	for (char ch : str)
+		bits += g_hpack_huff_table[(uint8_t)ch].bits;
+
+	size_t huff_len = size_t((bits + 7) / 8);
+	if (huff_len >= str.size())
+	{
+		write_int<7>(out, 0, (uint32_t)str.size());
+		out.append(str.data(), str.size());
+		return;
+	}
+
+	write_int<7>(out, 0x80, (uint32_t)huff_len);
+
+	uint64_t acc = 0;
+	int acc_bits = 0;
+	for (char ch : str)
+	{
+		auto const & code = g_hpack_huff_table[(uint8_t)ch];
+		acc = (acc << code.bits) | code.code;
+		acc_bits += code.bits;
+
+		while (acc_bits >= 8)
+		{
+			acc_bits -= 8;
+			out.push_back(char(acc >> acc_bits));
+		}
+	}
+
+	if (acc_bits)
+		out.push_back(char((acc << (8 - acc_bits)) | (0xff >> acc_bits)));
+}
+
+static bool is_sensitive_header(std::string_view name)
+{
+	return name == "authorization"
+		|| name == "proxy-authorization"
+		|| name == "cookie"
+		|| name == "set-cookie";
+}
+
+static bool is_volatile_header(std::string_view name)
+{
+	// Values of these are rarely repeated, indexing them would only
+	// evict more useful entries.
+	return name == ":path"
+		|| name == "content-length"
+		|| name == "date"
+		|| name == "etag"
+		|| name == "last-modified"
+		|| name == "location";
+}
+
+namespace {
+
+struct static_index
+{
+	std::unordered_map<std::string_view, size_t, hpack_encoder_hash> names;
+	std::unordered_map<std::pair<std::string_view, std::string_view>, size_t, hpack_encoder_hash> fields;
+
+	static_index()
+	{
+		for (size_t i = g_static_table_size; i != 0; --i)
+		{
+			auto const & e = g_static_table[i - 1];
+			names[e.name] = i;
+			if (!e.value.empty())
+				fields[{ e.name, e.value }] = i;
+		}
+	}
+};
+
+}
+
+size_t hpack_encoder_hash::operator()(std::string_view s) const noexcept
+{
+	size_t h = 14695981039346656037ull;
+	for (char ch : s)
+	{
+		h ^= (uint8_t)ch;
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+size_t hpack_encoder_hash::operator()(std::pair<std::string_view, std::string_view> const & f) const noexcept
+{
+	return (*this)(f.first) * 31 + (*this)(f.second);
+}
+
+hpack_encoder::hpack_encoder(size_t max_cap)
+	: inserted_(0), table_size_(0), table_capacity_(max_cap), preferred_capacity_(max_cap),
+	size_update_pending_(false), pending_min_capacity_(max_cap)
+{
+}
+
+void hpack_encoder::set_max_capacity(size_t max_cap)
+{
+	size_t cap = (std::min)(max_cap, preferred_capacity_);
+	if (cap == table_capacity_)
+		return;
+
+	this->evict(cap);
+	table_capacity_ = cap;
+	pending_min_capacity_ = (std::min)(pending_min_capacity_, cap);
+	size_update_pending_ = true;
+}
+
+void hpack_encoder::begin_block(std::string & out)
+{
+	if (!size_update_pending_)
+		return;
+
+	if (pending_min_capacity_ < table_capacity_)
+		write_int<5>(out, 0x20, (uint32_t)pending_min_capacity_);
+	write_int<5>(out, 0x20, (uint32_t)table_capacity_);
+
+	size_update_pending_ = false;
+	pending_min_capacity_ = table_capacity_;
+}
+
+void hpack_encoder::evict(size_t capacity)
+{
+	while (table_size_ > capacity)
+	{
+		uint64_t id = inserted_ - table_.size() + 1;
+		auto const & e = table_.front();
+
+		auto name_it = names_.find(e.name);
+		if (name_it != names_.end() && name_it->second == id)
+			names_.erase(name_it);
+
+		auto field_it = fields_.find({ e.name, e.value });
+		if (field_it != fields_.end() && field_it->second == id)
+			fields_.erase(field_it);
+
+		table_size_ -= e.name.size() + e.value.size() + 32;
+		table_.pop_front();
+	}
+}
+
+void hpack_encoder::add(std::string_view name, std::string_view value)
+{
+	size_t entry_size = name.size() + value.size() + 32;
+	if (entry_size > table_capacity_)
+	{
+		this->evict(0);
+		return;
+	}
+
+	this->evict(table_capacity_ - entry_size);
+
+	table_.push_back({ std::string(name), std::string(value) });
+	table_size_ += entry_size;
+
+	// The keys refer to the strings of the entries. Existing keys belong to
+	// older entries and are replaced, so that they don't outlive them.
+	uint64_t id = ++inserted_;
+	auto const & e = table_.back();
+	names_.erase(e.name);
+	names_.emplace(e.name, id);
+	fields_.erase({ e.name, e.value });
+	fields_.emplace(std::make_pair(std::string_view(e.name), std::string_view(e.value)), id);
+}
+
+void hpack_encoder::encode(std::string & out, std::string_view name, std::string_view value)
+{
+	if (std::any_of(name.begin(), name.end(), [](char ch) { return 'A' <= ch && ch <= 'Z'; }))
+	{
+		name_buf_.assign(name.data(), name.size());
+		for (char & ch : name_buf_)
+		{
+			if ('A' <= ch && ch <= 'Z')
+				ch += 'a' - 'A';
+		}
+		name = name_buf_;
+	}
+
+	static static_index const statics;
+
+	auto dynamic_index = [&](uint64_t id) {
+		return uint32_t(g_static_table_size + inserted_ - id + 1);
+	};
+
+	bool sensitive = is_sensitive_header(name);
+	if (!sensitive)
+	{
+		auto sit = statics.fields.find({ name, value });
+		if (sit != statics.fields.end())
+		{
+			write_int<7>(out, 0x80, (uint32_t)sit->second);
+			return;
+		}
+
+		auto dit = fields_.find({ name, value });
+		if (dit != fields_.end())
+		{
+			write_int<7>(out, 0x80, dynamic_index(dit->second));
+			return;
+		}
+	}
+
+	uint32_t name_idx = 0;
+	auto snit = statics.names.find(name);
+	if (snit != statics.names.end())
+	{
+		name_idx = (uint32_t)snit->second;
+	}
+	else
+	{
+		auto dnit = names_.find(name);
+		if (dnit != names_.end())
+			name_idx = dynamic_index(dnit->second);
+	}
+
+	bool index = !sensitive
+		&& !is_volatile_header(name)
+		&& (name.size() + value.size() + 32) * 4 <= table_capacity_ * 3;
+
+	if (sensitive)
+		write_int<4>(out, 0x10, name_idx);
+	else if (index)
+		write_int<6>(out, 0x40, name_idx);
+	else
+		write_int<4>(out, 0x00, name_idx);
+
+	if (name_idx == 0)
+		write_string(out, name);
+	write_string(out, value);
+
+	if (index)
+		this->add(name, value);
+}
@@ -3,40 +3,150 @@
 
 #include "http_server.hpp"
 #include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
+// The decoder's dynamic table.
+//
+// Names and values are stored next to each other in a single ring buffer,
+// an entry is never split at the end of the buffer. The buffer is twice the
+// capacity in size, so a new entry always fits either after the newest one
+// or at the start. Entries are located by a circular array of offsets.
 struct hpack_dynamic_table
 {
-	explicit hpack_dynamic_table();
+	explicit hpack_dynamic_table(size_t capacity = 0);
 
+	// Evicts the oldest entries until the table fits.
 	void resize(size_t capacity);
-	size_t size() const;
+
+	size_t size() const
+	{
+		return count_;
+	}
+
+	// Index 0 is the most recently added entry. The strings remain valid
+	// until the table is next modified.
 	header_view operator[](size_t index) const;
-	void add(std::string name, std::string value);
+
+	// The strings may refer to an entry of the table.
+	void add(std::string_view name, std::string_view value);
 
 private:
 	struct entry
 	{
-		std::string name;
-		std::string value;
+		uint64_t pos;
+		uint32_t name_size;
+		uint32_t value_size;
 	};
 
-	std::deque<entry> table_;
+	void evict(size_t capacity);
+	void reserve(size_t capacity);
+
+	std::unique_ptr<char[]> data_;
+	size_t data_size_;
+
+	// Positions grow without wrapping, the offset in the buffer is taken
+	// modulo its size.
+	uint64_t tail_;
+
+	std::vector<entry> entries_;
+	size_t first_;
+	size_t count_;
+
 	size_t table_size_;
 	size_t table_capacity_;
+
+	std::string scratch_;
+};
+
+enum class hpack_result
+{
+	ok,
+	incomplete,
+	invalid,
 };
 
 struct hpack_decoder
 {
-	explicit hpack_decoder(size_t max_cap);
+	// The fields of header lists larger than `max_list_size`, counted as for
+	// SETTINGS_MAX_HEADER_LIST_SIZE, are dropped. The block is still decoded
+	// to keep the dynamic table in sync.
+	explicit hpack_decoder(size_t max_cap, size_t max_list_size = size_t(-1));
+
+	// Decodes a fragment of a header block. A field representation that
+	// is split between fragments is kept until the next fragment arrives,
+	// `end_of_block` must be set for the last one.
+	//
+	// Names and values of the static table refer to it, all other strings
+	// are written once to `arena`, Huffman-coded ones as they are decoded.
+	// The fields remain valid for as long as the arena.
+	bool decode(header_list & headers, std::string_view buf, bool end_of_block, http_arena & arena);
 
-	bool decode(std::vector<header> & headers, std::string_view buf);
+	// The size of the header list decoded from the current or the last
+	// block, including the dropped fields.
+	uint64_t list_size() const
+	{
+		return list_size_;
+	}
 
 private:
+	hpack_result decode_field(header_list & headers, char const *& first, char const * last, http_arena & arena);
+	void emit(header_list & headers, header_view hv, bool copy_name, bool copy_value, http_arena & arena);
+
 	size_t entry_count() const;
 	header_view get_entry(size_t index) const;
 
 	hpack_dynamic_table dynamic_table_;
 	size_t table_max_capacity_;
+
+	uint64_t list_size_;
+	uint64_t max_list_size_;
+	bool in_block_;
+
+	std::string partial_;
+	std::string joined_;
+};
+
+struct hpack_encoder_hash
+{
+	size_t operator()(std::string_view s) const noexcept;
+	size_t operator()(std::pair<std::string_view, std::string_view> const & f) const noexcept;
+};
+
+struct hpack_encoder
+{
+	explicit hpack_encoder(size_t max_cap = 4096);
+
+	// Limits the dynamic table to the peer's SETTINGS_HEADER_TABLE_SIZE.
+	// The change is signalled at the start of the next header block.
+	void set_max_capacity(size_t max_cap);
+
+	void begin_block(std::string & out);
+	void encode(std::string & out, std::string_view name, std::string_view value);
+
+private:
+	struct entry
+	{
+		std::string name;
+		std::string value;
+	};
+
+	void evict(size_t capacity);
+	void add(std::string_view name, std::string_view value);
+
+	std::deque<entry> table_;
+	uint64_t inserted_;
+	size_t table_size_;
+	size_t table_capacity_;
+	size_t preferred_capacity_;
+	bool size_update_pending_;
+	size_t pending_min_capacity_;
+
+	std::unordered_map<std::string_view, uint64_t, hpack_encoder_hash> names_;
+	std::unordered_map<std::pair<std::string_view, std::string_view>, uint64_t, hpack_encoder_hash> fields_;
+
+	std::string name_buf_;
 };
 
 #endif // HPACK_HPP
@@ -0,0 +1,429 @@
+#include "http1.hpp"
+#include <string_utils.hpp>
+#include <algorithm>
+#include <cstring>
+
+static std::pair<uint16_t, std::string_view> const status_texts[] = {
+	{ 200, "OK" },
+	{ 303, "See Other" },
+	{ 400, "Bad Request" },
+	{ 404, "Not Found" },
+	{ 405, "Method Not Allowed" },
+	{ 413, "Payload Too Large" },
+	{ 500, "Internal Server Error" },
+};
+
+static bool load_num(uint64_t & num, std::string_view str)
+{
+	if (str.empty())
+		return false;
+
+	uint64_t r = 0;
+	while (!str.empty())
+	{
+		char ch = str[0];
+		if ('0' > ch || ch > '9')
+			return false;
+
+		uint64_t new_r = r * 10 + (ch - '0');
+		if (new_r < r)
+			return false;
+
+		r = new_r;
+		str.remove_prefix(1);
+	}
+
+	num = r;
+	return true;
+}
+
+size_t find_request_head(std::string_view buf, size_t & scanned)
+{
+	size_t pos = scanned < 3? 0: scanned - 3;
+	pos = buf.find(std::string_view("\r\n\r\n", 4), pos);
+	if (pos == std::string_view::npos)
+	{
+		scanned = buf.size();
+		return 0;
+	}
+
+	scanned = 0;
+	return pos + 4;
+}
+
+bool parse_request_head(request & req, std::string_view head)
+{
+	auto parse_until = [&](std::string_view & r, char sep) {
+		size_t pos = head.find(sep);
+		if (pos == std::string_view::npos)
+			return false;
+		r = head.substr(0, pos);
+		head.remove_prefix(pos + 1);
+		return true;
+	};
+
+	auto consume = [&](char ch) {
+		if (head.empty() || head[0] != ch)
+			return false;
+		head.remove_prefix(1);
+		return true;
+	};
+
+	std::string_view version;
+	if (
+		!parse_until(req.method, ' ')
+		|| !parse_until(req.path, ' ')
+		|| !parse_until(version, '\r')
+		|| !consume('\n'))
+	{
+		return false;
+	}
+
+	if (req.method.empty() || req.path.empty() || version != "HTTP/1.1")
+		return false;
+
+	std::string_view line;
+	while (parse_until(line, '\r') && consume('\n'))
+	{
+		if (line.empty())
+		{
+			std::sort(req.headers.begin(), req.headers.end());
+			return true;
+		}
+
+		size_t colon_pos = line.find(':');
+		if (colon_pos == std::string_view::npos)
+			return false;
+
+		header_view hv;
+		hv.name = line.substr(0, colon_pos);
+		hv.value = strip(line.substr(colon_pos + 1));
+		req.headers.push_back(hv);
+	}
+
+	return false;
+}
+
+body_kind get_body_kind(request const & req, uint64_t & content_length)
+{
+	bool has_body =
+		req.method == std::string_view("POST")
+		|| req.method == "PUT";
+
+	if (!has_body)
+		return body_kind::none;
+
+	if (std::string_view const * cl = get_single(req.headers, "content-length"))
+	{
+		if (load_num(content_length, *cl))
+			return body_kind::fixed;
+	}
+
+	bool chunked = false;
+	for (std::string_view tok: enum_headers(req.headers, "transfer-encoding"))
+	{
+		if (chunked || tok != "chunked")
+			return body_kind::invalid;
+
+		chunked = true;
+	}
+
+	return chunked? body_kind::chunked: body_kind::none;
+}
+
+chunked_decoder::chunked_decoder()
+	: state_(state::size), remaining_(0), has_digits_(false), line_len_(0)
+{
+}
+
+bool chunked_decoder::done() const
+{
+	return state_ == state::done;
+}
+
+bool chunked_decoder::decode(std::string_view & in, char * out, size_t & len)
+{
+	static size_t const max_line_len = 4096;
+
+	size_t written = 0;
+	while (!in.empty() && state_ != state::done)
+	{
+		if (state_ == state::data)
+		{
+			if (written == len)
+				break;
+
+			size_t n = (std::min)(in.size(), len - written);
+			if (n > remaining_)
+				n = (size_t)remaining_;
+
+			memcpy(out + written, in.data(), n);
+			in.remove_prefix(n);
+			written += n;
+
+			remaining_ -= n;
+			if (remaining_ == 0)
+				state_ = state::data_cr;
+			continue;
+		}
+
+		char ch = in[0];
+		in.remove_prefix(1);
+
+		switch (state_)
+		{
+		case state::size:
+			if (('0' <= ch && ch <= '9') || ('a' <= ch && ch <= 'f') || ('A' <= ch && ch <= 'F'))
+			{
+				if (remaining_ >> 60)
+					return false;
+
+				int digit = ch <= '9'? ch - '0': (ch | 0x20) - 'a' + 10;
+				remaining_ = remaining_ * 16 + digit;
+				has_digits_ = true;
+			}
+			else if (!has_digits_)
+			{
+				return false;
+			}
+			else if (ch == '\r')
+			{
+				state_ = state::size_lf;
+			}
+			else if (ch == ';' || ch == ' ' || ch == '\t')
+			{
+				line_len_ = 0;
+				state_ = state::extension;
+			}
+			else
+			{
+				return false;
+			}
+			break;
+
+		case state::extension:
+			if (ch == '\r')
+				state_ = state::size_lf;
+			else if (++line_len_ > max_line_len)
+				return false;
+			break;
+
+		case state::size_lf:
+			if (ch != '\n')
+				return false;
+
+			has_digits_ = false;
+			line_len_ = 0;
+			state_ = remaining_ != 0? state::data: state::trailer;
+			break;
+
+		case state::data_cr:
+			if (ch != '\r')
+				return false;
+			state_ = state::data_lf;
+			break;
+
+		case state::data_lf:
+			if (ch != '\n')
+				return false;
+			state_ = state::size;
+			break;
+
+		case state::trailer:
+			// An empty line ends the trailer section.
+			if (ch == '\r')
+				state_ = state::trailer_lf;
+			else if (++line_len_ > max_line_len)
+				return false;
+			break;
+
+		case state::trailer_lf:
+			if (ch != '\n')
+				return false;
+
+			state_ = line_len_ == 0? state::done: state::trailer;
+			line_len_ = 0;
+			break;
+
+		case state::data:
+		case state::done:
+			break;
+		}
+	}
+
+	len = written;
+	return true;
+}
+
+// Decodes the unpadded base64url encoding used by HTTP2-Settings.
+static bool decode_base64url(std::string & out, std::string_view str)
+{
+	uint32_t acc = 0;
+	int bits = 0;
+	for (char ch : str)
+	{
+		uint32_t v;
+		if ('A' <= ch && ch <= 'Z')
+			v = ch - 'A';
+		else if ('a' <= ch && ch <= 'z')
+			v = ch - 'a' + 26;
+		else if ('0' <= ch && ch <= '9')
+			v = ch - '0' + 52;
+		else if (ch == '-')
+			v = 62;
+		else if (ch == '_')
+			v = 63;
+		else
+			return false;
+
+		acc = (acc << 6) | v;
+		bits += 6;
+		if (bits >= 8)
+		{
+			bits -= 8;
+			out.push_back(char(acc >> bits));
+			acc &= (1 << bits) - 1;
+		}
+	}
+
+	return bits < 6;
+}
+
+// Returns true if one of the comma-separated values of the header
+// `name` is `token`.
+static bool has_token(header_list const & headers, std::string_view name, std::string_view token)
+{
+	for (std::string_view value : enum_headers(headers, name))
+	{
+		while (!value.empty())
+		{
+			size_t pos = value.find(',');
+			std::string_view tok = strip(value.substr(0, pos));
+			value = pos == std::string_view::npos? std::string_view(): value.substr(pos + 1);
+
+			if (compare_header_name(tok, token) == 0)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+bool get_h2c_upgrade(request const & req, std::string & settings)
+{
+	if (!has_token(req.headers, "upgrade", "h2c"))
+		return false;
+
+	// The Connection header must list both, otherwise an intermediary
+	// may have forwarded the request without them (RFC 7540 3.2).
+	if (!has_token(req.headers, "connection", "upgrade") || !has_token(req.headers, "connection", "http2-settings"))
+		return false;
+
+	std::string_view const * encoded = get_single(req.headers, "http2-settings");
+	if (!encoded)
+		return false;
+
+	settings.clear();
+	return decode_base64url(settings, *encoded) && settings.size() % 6 == 0;
+}
+
+static void append_decimal(std::string & out, uint64_t value)
+{
+	char buf[20];
+	size_t len = 0;
+	do
+	{
+		buf[len++] = char('0' + value % 10);
+		value /= 10;
+	}
+	while (value);
+
+	std::reverse(buf, buf + len);
+	out.append(buf, len);
+}
+
+void format_response_head(std::string & out, response & resp)
+{
+	if (resp.body == nullptr)
+		resp.content_length = 0;
+
+	std::string_view status_text = resp.status_text;
+	if (status_text.empty())
+	{
+		status_text = "No Status Text";
+		for (auto const & kv : status_texts)
+		{
+			if (resp.status_code == kv.first)
+			{
+				status_text = kv.second;
+				break;
+			}
+		}
+	}
+
+	out.append("HTTP/1.1 ");
+	append_decimal(out, resp.status_code);
+	out.append(" ");
+	out.append(status_text.data(), status_text.size());
+	out.append("\r\n");
+	for (auto const & header : resp.headers)
+	{
+		out.append(header.name);
+		out.append(":");
+		out.append(header.value);
+		out.append("\r\n");
+	}
+
+	if (resp.content_length != http_body::unknown_size)
+	{
+		out.append("content-length:");
+		append_decimal(out, resp.content_length);
+		out.append("\r\n\r\n");
+	}
+	else
+	{
+		out.append("transfer-encoding:chunked\r\n\r\n");
+	}
+}
+
+response_gather::response_gather(std::string_view head, std::string_view const * slices, size_t slice_count)
+	: head_(head), slices_(slices), slice_count_(slice_count)
+{
+}
+
+size_t response_gather::next(std::string_view * bufs, size_t count)
+{
+	size_t r = 0;
+	if (!head_.empty() && r != count)
+	{
+		bufs[r++] = head_;
+		head_ = {};
+	}
+
+	while (slice_count_ && r != count)
+	{
+		if (!slices_->empty())
+			bufs[r++] = *slices_;
+		++slices_;
+		--slice_count_;
+	}
+
+	return r;
+}
+
+size_t format_chunk_header(char * buf, uint64_t chunk_size)
+{
+	size_t len = 0;
+	do
+	{
+		static char const digits[] = "0123456789abcdef";
+		buf[len++] = digits[chunk_size & 0xf];
+		chunk_size >>= 4;
+	}
+	while (chunk_size);
+
+	std::reverse(buf, buf + len);
+	buf[len++] = '\r';
+	buf[len++] = '\n';
+	return len;
+}
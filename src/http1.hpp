@@ -0,0 +1,94 @@
+#ifndef HTTP1_HPP
+#define HTTP1_HPP
+
+#include "http_server.hpp"
+
+// Serves a connection whose first bytes, `buffered`, were already read
+// from `in`. Requests refer to `info` if it is not null.
+void http_server(istream & in, ostream & out, std::function<response(request &&)> const & fn, http2_options const & h2opts,
+	std::string_view buffered, http_connection_info const * info = nullptr);
+
+// Returns the length of the request head in `buf`, including the empty line
+// that terminates it, or zero if the head is not complete yet. `scanned` keeps
+// track of the bytes already searched between calls.
+size_t find_request_head(std::string_view buf, size_t & scanned);
+
+bool parse_request_head(request & req, std::string_view head);
+
+enum class body_kind
+{
+	none,
+	fixed,
+	chunked,
+	invalid,
+};
+
+body_kind get_body_kind(request const & req, uint64_t & content_length);
+
+// Decodes a chunked request body as it arrives. Chunk extensions and
+// trailer fields are skipped.
+struct chunked_decoder
+{
+	chunked_decoder();
+
+	// Consumes input from the front of `in` and writes at most `len` bytes
+	// of the body to `out`, `len` is set to the number of bytes written.
+	// Input is only left unconsumed once `out` is full or the body is
+	// complete. Returns false if the encoding is malformed.
+	bool decode(std::string_view & in, char * out, size_t & len);
+
+	bool done() const;
+
+private:
+	enum class state
+	{
+		size,
+		extension,
+		size_lf,
+		data,
+		data_cr,
+		data_lf,
+		trailer,
+		trailer_lf,
+		done,
+	};
+
+	state state_;
+	uint64_t remaining_;
+	bool has_digits_;
+
+	// The length of the current extension or trailer line.
+	size_t line_len_;
+};
+
+// Returns true if the client asks to upgrade the connection to HTTP/2
+// and stores the decoded HTTP2-Settings header in `settings`. Requests
+// without a valid HTTP2-Settings header, or whose Connection header does
+// not list both "Upgrade" and "HTTP2-Settings", must not be upgraded.
+bool get_h2c_upgrade(request const & req, std::string & settings);
+
+// Appends the status line, the headers and the framing header of `resp`
+// to `out`.
+void format_response_head(std::string & out, response & resp);
+
+// Splits the head of a response and its in-memory body into batches of
+// buffers for vectored writes.
+struct response_gather
+{
+	response_gather(std::string_view head, std::string_view const * slices, size_t slice_count);
+
+	// Fills `bufs` with the next non-empty buffers and returns their
+	// number, zero once everything was gathered.
+	size_t next(std::string_view * bufs, size_t count);
+
+private:
+	std::string_view head_;
+	std::string_view const * slices_;
+	size_t slice_count_;
+};
+
+// Writes the hexadecimal chunk size followed by CRLF, `buf` must have room
+// for at least 18 characters.
+size_t format_chunk_header(char * buf, uint64_t chunk_size);
+
+#endif // HTTP1_HPP
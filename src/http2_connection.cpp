@@ -0,0 +1,1566 @@
+#include "http2_connection.hpp"
+#include "hpack.hpp"
+#include "http2_frame.hpp"
+#include "http2_output.hpp"
+#include "http2_scheduler.hpp"
+#include "http2_stream.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+
+struct endpoint_settings
+{
+	uint32_t header_table_size = 4096;
+	bool enable_push = true;
+	uint32_t max_concurrent_streams = (uint32_t)-1;
+	int32_t initial_window_size = 65535;
+	uint32_t max_frame_size = 16384;
+	uint32_t max_header_list_size = (uint32_t)-1;
+	bool no_rfc7540_priorities = false;
+};
+
+// A token bucket, events are allowed in bursts of up to `burst` and
+// the allowance refills at `rate` per second.
+struct rate_limit
+{
+	typedef std::chrono::steady_clock clock;
+
+	rate_limit(uint32_t burst, uint32_t rate)
+		: burst(burst), tokens(burst),
+		period(rate != 0? clock::duration(std::chrono::seconds(1)) / rate: clock::duration::max())
+	{
+	}
+
+	bool take()
+	{
+		clock::time_point now = clock::now();
+		if (tokens == burst)
+		{
+			last = now;
+		}
+		else
+		{
+			auto refill = (now - last) / period;
+			if (refill >= burst - tokens)
+			{
+				tokens = burst;
+				last = now;
+			}
+			else
+			{
+				tokens += uint32_t(refill);
+				last += refill * period;
+			}
+		}
+
+		if (tokens == 0)
+			return false;
+
+		--tokens;
+		return true;
+	}
+
+	uint32_t burst;
+	uint32_t tokens;
+	clock::duration period;
+	clock::time_point last;
+};
+
+static int64_t const max_window_size = 0x7fffffff;
+static size_t const max_queued_bytes = 64 * 1024;
+static size_t const max_early_priorities = 16;
+
+// A header block may be split into this many frames at most. Even empty
+// CONTINUATION frames have to be processed.
+static size_t const max_continuation_frames = 16;
+
+// Replies to the client's frames are refused once this much output is
+// waiting to be written; a client that doesn't read them could otherwise
+// make the queue grow without bound.
+static size_t const max_unread_output = 1024 * 1024;
+
+static bool is_connection_header(std::string_view name)
+{
+	static std::string_view const names[] = {
+		"connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade",
+	};
+
+	for (auto const & n : names)
+	{
+		if (compare_header_name(n, name) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+static bool make_request(request & req, header_list const & headers, http_arena * arena)
+{
+	req.arena = arena;
+	req.headers = header_list(arena);
+
+	std::string_view authority;
+	bool has_host = false;
+	bool regular_seen = false;
+
+	for (auto const & h : headers)
+	{
+		std::string_view name = h.name;
+		if (!name.empty() && name[0] == ':')
+		{
+			if (regular_seen)
+				return false;
+
+			if (name == ":method")
+				req.method = h.value;
+			else if (name == ":path")
+				req.path = h.value;
+			else if (name == ":authority")
+				authority = h.value;
+			else if (name != ":scheme")
+				return false;
+			continue;
+		}
+
+		regular_seen = true;
+		if (is_connection_header(name))
+			return false;
+		if (name == "host")
+			has_host = true;
+
+		req.headers.push_back(h);
+	}
+
+	if (req.method.empty() || req.path.empty())
+		return false;
+
+	if (!has_host && !authority.empty())
+		req.headers.push_back({ "host", authority });
+
+	std::sort(req.headers.begin(), req.headers.end());
+	return true;
+}
+
+struct http2_connection::impl
+{
+	enum class send_result
+	{
+		more,
+		done,
+		stream_blocked,
+		connection_blocked,
+		failed,
+	};
+
+	explicit impl(http2_options const & opts);
+
+	[[noreturn]] void connection_error(error_code ec);
+	void stream_error(uint32_t stream_id, http2_stream & stream, error_code ec);
+	void close_stream(uint32_t stream_id, http2_stream & stream);
+	void reclaim(uint32_t stream_id, http2_stream & stream);
+
+	void send_goaway(uint32_t last_stream_id, error_code ec);
+	void start_drain();
+
+	void send_settings(endpoint_settings const & settings);
+	void apply_client_settings(endpoint_settings const & settings);
+	void sample_bandwidth(uint32_t len);
+	void grow_recv_windows(uint64_t bdp);
+
+	void limit_rate(rate_limit & limit);
+
+	void send_frame(frame_type type, char flags, uint32_t stream_id, std::string_view payload, std::shared_ptr<void> owner = nullptr);
+	void send_reply(frame_type type, char flags, uint32_t stream_id, std::string_view payload);
+	void send_window_update(uint32_t stream_id, uint32_t increment);
+	void send_rst_stream(uint32_t stream_id, error_code ec);
+	void release_conn_window();
+	void drop_received(http2_stream & stream);
+	void refuse_queued_bodies();
+	void release_stream_window(uint32_t stream_id, http2_stream & stream, uint32_t len);
+	void discard_received(uint32_t stream_id, http2_stream & stream);
+
+	void schedule(uint32_t stream_id, http2_stream & stream);
+	void reprioritize(uint32_t stream_id, http2_stream & stream, http2_priority prio);
+	send_result send_data(uint32_t stream_id, http2_stream & stream);
+	void pump_data();
+	void send_response(uint32_t stream_id, http2_stream & stream, response resp);
+
+	void process_input();
+	void process_frame(http2_frame & frame);
+	void on_headers(http2_frame & frame);
+	void on_header_fragment(std::string_view fragment, bool end_headers);
+	void on_trailers(uint32_t stream_id);
+	void accept_request(uint32_t stream_id, http2_stream & stream, uint64_t list_size);
+	void on_data(http2_frame const & frame);
+	void receive_body(http2_frame const & frame, http2_stream & stream, std::string_view data);
+	void on_window_update(http2_frame const & frame);
+	void on_priority_update(http2_frame const & frame);
+	void on_rst_stream(http2_frame const & frame);
+	void on_goaway(http2_frame const & frame);
+	void on_ping(http2_frame const & frame);
+	void on_settings(http2_frame const & frame);
+	void apply_server_settings(std::string_view payload);
+
+	http2_options opts;
+
+	http2_frame_reader reader;
+	bool preface_received;
+
+	http2_output_queue send_queue;
+
+	http2_stream_table streams;
+	uint32_t next_client_stream;
+
+	// The highest stream that was accepted for processing, reported
+	// in GOAWAY frames.
+	uint32_t last_stream_id;
+	std::deque<uint32_t> ready_streams;
+
+	hpack_decoder header_dec;
+	hpack_encoder header_enc;
+
+	// The stream whose header block is being continued, zero if none.
+	// The block of a refused stream is decoded all the same, as it affects
+	// the state of the decoder. So are trailers, which are then dropped.
+	uint32_t continued_stream;
+	bool continued_refused;
+	bool continued_trailers;
+	bool continued_end_stream;
+	http_arena trailer_arena;
+	size_t header_block_size;
+	size_t continuation_frames;
+
+	// Limits of the frames and stream resets that cost work without
+	// producing responses.
+	rate_limit control_frames;
+	rate_limit stream_resets;
+
+	// The settings the client acknowledged, those it is yet to acknowledge
+	// and the ones it will end up with.
+	endpoint_settings next_server_settings;
+	endpoint_settings client_settings;
+	std::deque<endpoint_settings> client_settings_in_flight;
+	endpoint_settings advertised_settings;
+
+	int64_t conn_send_window;
+	int64_t conn_recv_window;
+	uint32_t conn_recv_unacked;
+	uint32_t conn_window_size;
+
+	// Request body data buffered for handlers that are yet to read it.
+	uint64_t buffered_body;
+
+	// While data is arriving, a PING is kept in flight. The data received
+	// during its round trip estimates the bandwidth-delay product, and the
+	// receive windows are grown whenever they are what limits the client.
+	bool bdp_ping_pending;
+	std::chrono::steady_clock::time_point bdp_ping_sent;
+	uint64_t bdp_bytes;
+	std::chrono::steady_clock::duration rtt;
+
+	// Streams with response data and a positive send window are scheduled,
+	// the connection window is then handed out in the order of their
+	// priorities.
+	http2_scheduler scheduler;
+
+	// PRIORITY_UPDATE frames may arrive before the stream is opened.
+	std::vector<std::pair<uint32_t, http2_priority>> early_priorities;
+
+	// A graceful shutdown first announces a GOAWAY with the highest
+	// possible stream identifier, so that streams the client is opening
+	// in the meantime are not lost. After a PING round trip, the final
+	// GOAWAY names the last stream that will be processed.
+	enum class drain_phase
+	{
+		none,
+		announced,
+		final,
+	};
+
+	drain_phase drain;
+	bool failed;
+};
+
+// The payloads of the PING that ends the first phase of a graceful
+// shutdown and of the one that measures the round trip time.
+static char const drain_ping[8] = { 'd', 'r', 'a', 'i', 'n', 0, 0, 0 };
+static char const bdp_ping[8] = { 'b', 'd', 'p', 0, 0, 0, 0, 0 };
+
+http2_connection::impl::impl(http2_options const & opts)
+	: opts(opts), preface_received(false), next_client_stream(1), last_stream_id(0),
+	header_dec(opts.header_table_size, opts.max_header_list_size), header_enc(4096),
+	continued_stream(0), continued_refused(false), continued_trailers(false), continued_end_stream(false),
+	header_block_size(0), continuation_frames(0),
+	control_frames(opts.max_control_burst, opts.max_control_rate),
+	stream_resets(opts.max_reset_burst, opts.max_reset_rate),
+	conn_send_window(65535), conn_recv_window(65535), conn_recv_unacked(0), conn_window_size(65535),
+	buffered_body(0),
+	bdp_ping_pending(false), bdp_bytes(0), rtt(0), drain(drain_phase::none), failed(false)
+{
+	if (opts.max_frame_size < 16384 || opts.max_frame_size >= (1 << 24))
+		throw std::invalid_argument("invalid HTTP/2 max frame size");
+	if (opts.initial_window_size > max_window_size)
+		throw std::invalid_argument("invalid HTTP/2 initial window size");
+
+	endpoint_settings settings;
+	settings.header_table_size = opts.header_table_size;
+	settings.max_concurrent_streams = opts.max_concurrent_streams;
+	settings.initial_window_size = int32_t(opts.initial_window_size);
+	settings.max_frame_size = opts.max_frame_size;
+	settings.max_header_list_size = opts.max_header_list_size;
+
+	// Streams are prioritized according to RFC 9218.
+	settings.no_rfc7540_priorities = true;
+	this->send_settings(settings);
+
+	// Frames up to the advertised size are accepted even before the client
+	// acknowledges our settings, and so are streams up to the limit.
+	client_settings.max_frame_size = opts.max_frame_size;
+	client_settings.max_concurrent_streams = opts.max_concurrent_streams;
+
+	// The connection window starts out as large as a stream window.
+	if (opts.initial_window_size > conn_window_size)
+	{
+		uint32_t delta = opts.initial_window_size - conn_window_size;
+		this->send_window_update(0, delta);
+		conn_recv_window += delta;
+		conn_window_size += delta;
+	}
+}
+
+// Sends the settings that differ from what the client has been told so far.
+void http2_connection::impl::send_settings(endpoint_settings const & settings)
+{
+	char payload[6 * 6];
+	size_t size = 0;
+
+	auto add = [&](settings_ids id, uint32_t value, uint32_t old_value) {
+		if (value == old_value)
+			return;
+		store_be(payload + size, uint16_t(id));
+		store_be(payload + size + 2, value);
+		size += 6;
+	};
+
+	endpoint_settings const & old = advertised_settings;
+	add(settings_ids::header_table_size, settings.header_table_size, old.header_table_size);
+	add(settings_ids::max_concurrent_streams, settings.max_concurrent_streams, old.max_concurrent_streams);
+	add(settings_ids::initial_window_size, uint32_t(settings.initial_window_size), uint32_t(old.initial_window_size));
+	add(settings_ids::max_frame_size, settings.max_frame_size, old.max_frame_size);
+	add(settings_ids::max_header_list_size, settings.max_header_list_size, old.max_header_list_size);
+
+	add(settings_ids::no_rfc7540_priorities, settings.no_rfc7540_priorities, old.no_rfc7540_priorities);
+
+	advertised_settings = settings;
+	client_settings_in_flight.push_back(settings);
+	this->send_frame(frame_type::settings, 0, 0, { payload, size });
+}
+
+// The connection is unusable afterwards, the GOAWAY is the last frame
+// queued.
+void http2_connection::impl::connection_error(error_code ec)
+{
+	if (!failed)
+	{
+		failed = true;
+		this->send_goaway(last_stream_id, ec);
+	}
+
+	throw http2_connection_error(uint32_t(ec));
+}
+
+void http2_connection::impl::stream_error(uint32_t stream_id, http2_stream & stream, error_code ec)
+{
+	this->limit_rate(stream_resets);
+	this->send_rst_stream(stream_id, ec);
+	this->close_stream(stream_id, stream);
+}
+
+// Closes a stream that was reset by either side. Frames that arrive for
+// it later are ignored.
+void http2_connection::impl::close_stream(uint32_t stream_id, http2_stream & stream)
+{
+	if (stream.scheduled)
+	{
+		scheduler.unschedule(stream_id);
+		stream.scheduled = false;
+	}
+
+	stream.reset_pending();
+	this->drop_received(stream);
+	stream.discard_received = true;
+	stream.state = http2_stream_state::closed;
+	stream.reset = true;
+	this->reclaim(stream_id, stream);
+}
+
+// The request handed out for a stream refers to the stream's headers,
+// the stream stays until the response is submitted.
+void http2_connection::impl::reclaim(uint32_t stream_id, http2_stream & stream)
+{
+	if (!stream.handler_active)
+		streams.reclaim(stream_id);
+}
+
+void http2_connection::impl::send_goaway(uint32_t last_stream_id, error_code ec)
+{
+	char payload[8];
+	store_be(payload, last_stream_id);
+	store_be(payload + 4, uint32_t(ec));
+	this->send_frame(frame_type::goaway, 0, 0, { payload, sizeof payload });
+}
+
+void http2_connection::impl::start_drain()
+{
+	if (drain != drain_phase::none || failed)
+		return;
+
+	this->send_goaway(0x7fffffff, error_code::no_error);
+	this->send_frame(frame_type::ping, 0, 0, { drain_ping, sizeof drain_ping });
+	drain = drain_phase::announced;
+}
+
+void http2_connection::impl::limit_rate(rate_limit & limit)
+{
+	if (!limit.take())
+		this->connection_error(error_code::enhance_your_calm);
+}
+
+void http2_connection::impl::send_frame(frame_type type, char flags, uint32_t stream_id, std::string_view payload, std::shared_ptr<void> owner)
+{
+	if (owner)
+		send_queue.push(type, flags, stream_id, payload, std::move(owner));
+	else
+		send_queue.push(type, flags, stream_id, payload);
+}
+
+void http2_connection::impl::send_reply(frame_type type, char flags, uint32_t stream_id, std::string_view payload)
+{
+	if (send_queue.size() > max_unread_output)
+		this->connection_error(error_code::enhance_your_calm);
+
+	this->send_frame(type, flags, stream_id, payload);
+}
+
+void http2_connection::impl::send_window_update(uint32_t stream_id, uint32_t increment)
+{
+	char payload[4];
+	store_be(payload, increment);
+	this->send_frame(frame_type::window_update, 0, stream_id, { payload, sizeof payload });
+}
+
+void http2_connection::impl::send_rst_stream(uint32_t stream_id, error_code ec)
+{
+	char payload[4];
+	store_be(payload, uint32_t(ec));
+	this->send_reply(frame_type::rst_stream, 0, stream_id, { payload, sizeof payload });
+}
+
+// Received data is acknowledged in batches, once at least half
+// of the window can be released.
+//
+// The connection window is released as soon as the data is buffered,
+// so that a stream whose handler is yet to run can't hold up the others;
+// the stream windows bound the memory used by each stream. Data buffered
+// beyond `max_buffered_body` is only released as the handlers read it.
+void http2_connection::impl::release_conn_window()
+{
+	uint64_t held = 0;
+	if (buffered_body > opts.max_buffered_body)
+		held = buffered_body - opts.max_buffered_body;
+
+	if (conn_recv_unacked <= held)
+		return;
+
+	uint32_t len = uint32_t(conn_recv_unacked - held);
+	if (len >= conn_window_size / 2)
+	{
+		this->send_window_update(0, len);
+		conn_recv_window += len;
+		conn_recv_unacked -= len;
+	}
+}
+
+void http2_connection::impl::drop_received(http2_stream & stream)
+{
+	buffered_body -= stream.received.size() - stream.received_offset;
+	stream.received.clear();
+	stream.received_offset = 0;
+	this->release_conn_window();
+}
+
+// A handler waits for body data, but the connection window is held back
+// by the bodies of requests that are yet to be handled. Those requests are
+// refused to let the data through, the client may retry them.
+void http2_connection::impl::refuse_queued_bodies()
+{
+	for (auto it = ready_streams.rbegin(); it != ready_streams.rend() && buffered_body > opts.max_buffered_body; ++it)
+	{
+		http2_stream * stream = streams.find(*it);
+		if (!stream || stream->reset || stream->received_offset == stream->received.size())
+			continue;
+
+		this->send_rst_stream(*it, error_code::refused_stream);
+		this->close_stream(*it, *stream);
+	}
+}
+
+// Settings take effect once the client acknowledges them. A change of
+// the initial window size applies retroactively to all open streams.
+void http2_connection::impl::apply_client_settings(endpoint_settings const & settings)
+{
+	int64_t window_delta = int64_t(settings.initial_window_size) - client_settings.initial_window_size;
+	if (window_delta != 0)
+	{
+		streams.for_each([&](uint32_t, http2_stream & stream) {
+			stream.recv_window += window_delta;
+		});
+	}
+
+	client_settings = settings;
+}
+
+void http2_connection::impl::sample_bandwidth(uint32_t len)
+{
+	if (bdp_ping_pending)
+	{
+		bdp_bytes += len;
+		return;
+	}
+
+	if (conn_window_size >= opts.max_window_size || drain != drain_phase::none)
+		return;
+
+	this->send_frame(frame_type::ping, 0, 0, { bdp_ping, sizeof bdp_ping });
+	bdp_ping_pending = true;
+	bdp_ping_sent = std::chrono::steady_clock::now();
+	bdp_bytes = 0;
+}
+
+// Grows the windows if they are what limits the client. As window updates
+// are batched by half a window, a client limited by the window sends about
+// half of it per round trip. Stream windows grow through
+// SETTINGS_INITIAL_WINDOW_SIZE and the connection window through
+// WINDOW_UPDATE.
+void http2_connection::impl::grow_recv_windows(uint64_t bdp)
+{
+	if (bdp * 2 < conn_window_size)
+		return;
+
+	uint64_t size = (std::max)(bdp * 2, uint64_t(conn_window_size) * 2);
+	size = (std::min)(size, uint64_t(opts.max_window_size));
+	if (size <= conn_window_size)
+		return;
+
+	uint32_t delta = uint32_t(size) - conn_window_size;
+	this->send_window_update(0, delta);
+	conn_recv_window += delta;
+	conn_window_size = uint32_t(size);
+
+	if (size > uint32_t(advertised_settings.initial_window_size))
+	{
+		endpoint_settings settings = advertised_settings;
+		settings.initial_window_size = int32_t(size);
+		this->send_settings(settings);
+	}
+}
+
+void http2_connection::impl::release_stream_window(uint32_t stream_id, http2_stream & stream, uint32_t len)
+{
+	if (!stream.remote_open())
+		return;
+
+	uint32_t const threshold = uint32_t(client_settings.initial_window_size / 2);
+
+	stream.recv_unacked += len;
+	if (stream.recv_unacked >= threshold)
+	{
+		this->send_window_update(stream_id, stream.recv_unacked);
+		stream.recv_window += stream.recv_unacked;
+		stream.recv_unacked = 0;
+	}
+}
+
+void http2_connection::impl::discard_received(uint32_t stream_id, http2_stream & stream)
+{
+	size_t len = stream.received.size() - stream.received_offset;
+	this->drop_received(stream);
+	stream.received.shrink_to_fit();
+	stream.discard_received = true;
+	this->release_stream_window(stream_id, stream, uint32_t(len));
+}
+
+void http2_connection::impl::schedule(uint32_t stream_id, http2_stream & stream)
+{
+	if (stream.pending && !stream.scheduled && stream.send_window > 0)
+	{
+		scheduler.schedule(stream_id, stream.priority);
+		stream.scheduled = true;
+	}
+}
+
+void http2_connection::impl::reprioritize(uint32_t stream_id, http2_stream & stream, http2_priority prio)
+{
+	if (stream.scheduled)
+	{
+		scheduler.unschedule(stream_id);
+		scheduler.schedule(stream_id, prio);
+	}
+	stream.priority = prio;
+}
+
+// Queues at most one DATA frame of the pending response. In-memory
+// bodies are queued without copying, streamed bodies are read one
+// frame at a time.
+http2_connection::impl::send_result http2_connection::impl::send_data(uint32_t stream_id, http2_stream & stream)
+{
+	size_t const max_frame_size = next_server_settings.max_frame_size;
+	response & resp = *stream.pending;
+
+	if (stream.pending_data.empty() && !stream.pending_eof)
+	{
+		if (stream.pending_slices)
+		{
+			while (stream.pending_slice_count != 0 && stream.pending_data.empty())
+			{
+				stream.pending_data = *stream.pending_slices++;
+				--stream.pending_slice_count;
+			}
+
+			stream.pending_eof = stream.pending_slice_count == 0;
+		}
+		else
+		{
+			size_t chunk = max_frame_size;
+			if (chunk > stream.pending_remaining)
+				chunk = (size_t)stream.pending_remaining;
+
+			// Queued frames keep referring to the buffer,
+			// every read needs a fresh one.
+			stream.chunk = std::make_shared<std::string>(chunk, '\0');
+			try
+			{
+				chunk = chunk != 0? resp.body->read(&(*stream.chunk)[0], chunk): 0;
+			}
+			catch (...)
+			{
+				return send_result::failed;
+			}
+			stream.pending_data = std::string_view(stream.chunk->data(), chunk);
+
+			if (resp.content_length != http_body::unknown_size)
+			{
+				// A body shorter than announced must not end the stream
+				// as if it were complete.
+				if (chunk == 0)
+					return send_result::failed;
+				stream.pending_remaining -= chunk;
+			}
+			if (chunk == 0 || stream.pending_remaining == 0)
+				stream.pending_eof = true;
+		}
+	}
+
+	if (stream.pending_data.empty())
+	{
+		this->send_frame(frame_type::data, frame_flags::end_stream, stream_id, {});
+		return send_result::done;
+	}
+
+	if (stream.send_window <= 0)
+		return send_result::stream_blocked;
+	if (conn_send_window <= 0)
+		return send_result::connection_blocked;
+
+	size_t len = (std::min)(stream.pending_data.size(), max_frame_size);
+	len = size_t((std::min)(int64_t(len), (std::min)(conn_send_window, stream.send_window)));
+
+	std::shared_ptr<void> owner;
+	if (stream.pending_slices)
+		owner = stream.pending;
+	else
+		owner = stream.chunk;
+
+	bool last = stream.pending_eof && len == stream.pending_data.size();
+	this->send_frame(frame_type::data, last? frame_flags::end_stream: 0, stream_id, stream.pending_data.substr(0, len), std::move(owner));
+	stream.pending_data.remove_prefix(len);
+
+	conn_send_window -= len;
+	stream.send_window -= len;
+
+	if (last)
+		return send_result::done;
+	return stream.send_window > 0? send_result::more: send_result::stream_blocked;
+}
+
+// Sends as much of the pending response bodies as the flow control
+// windows allow. The output queue is kept short, so that data of more
+// urgent responses doesn't wait behind what was already queued; it is
+// refilled as the output is consumed.
+void http2_connection::impl::pump_data()
+{
+	while (send_queue.size() <= max_queued_bytes)
+	{
+		uint32_t stream_id = scheduler.next();
+		if (stream_id == 0)
+			break;
+
+		http2_stream & stream = *streams.find(stream_id);
+		send_result r = this->send_data(stream_id, stream);
+		if (r == send_result::connection_blocked)
+		{
+			scheduler.advance(true);
+			break;
+		}
+
+		scheduler.advance(r == send_result::more);
+		if (r != send_result::more)
+			stream.scheduled = false;
+
+		if (r == send_result::done)
+		{
+			stream.reset_pending();
+			stream.close_local();
+			this->reclaim(stream_id, stream);
+		}
+		else if (r == send_result::failed)
+		{
+			// The client must not take the truncated body for the whole.
+			this->send_rst_stream(stream_id, error_code::internal_error);
+			this->close_stream(stream_id, stream);
+		}
+	}
+}
+
+void http2_connection::impl::send_response(uint32_t stream_id, http2_stream & stream, response resp)
+{
+	if (resp.body == nullptr)
+		resp.content_length = 0;
+
+	auto block = std::make_shared<std::string>();
+	header_enc.begin_block(*block);
+	header_enc.encode(*block, ":status", std::to_string(resp.status_code));
+	for (auto const & h : resp.headers)
+	{
+		if (!is_connection_header(h.name))
+			header_enc.encode(*block, h.name, h.value);
+	}
+	if (resp.content_length != http_body::unknown_size)
+		header_enc.encode(*block, "content-length", std::to_string(resp.content_length));
+
+	size_t const max_frame_size = next_server_settings.max_frame_size;
+	bool const end_stream = resp.content_length == 0;
+
+	std::string_view rest = *block;
+	frame_type type = frame_type::headers;
+	do
+	{
+		std::string_view chunk = rest.substr(0, max_frame_size);
+		rest.remove_prefix(chunk.size());
+
+		char flags = 0;
+		if (type == frame_type::headers && end_stream)
+			flags |= frame_flags::end_stream;
+		if (rest.empty())
+			flags |= frame_flags::end_headers;
+
+		this->send_frame(type, flags, stream_id, chunk, block);
+		type = frame_type::continuation;
+	}
+	while (!rest.empty());
+
+	if (end_stream)
+	{
+		stream.close_local();
+		this->reclaim(stream_id, stream);
+		return;
+	}
+
+	stream.pending = std::make_shared<response>(std::move(resp));
+	stream.pending_remaining = stream.pending->content_length;
+
+	// In-memory bodies whose size doesn't match the announced length are
+	// read like streams, so that they are cut short or reset the same way.
+	stream.pending_slices = stream.pending->body.slices(stream.pending_slice_count);
+	if (stream.pending_slices && stream.pending_remaining != http_body::unknown_size
+		&& stream.pending_remaining != stream.pending->body.size())
+	{
+		stream.pending_slices = nullptr;
+	}
+	stream.pending_eof = false;
+	this->schedule(stream_id, stream);
+	this->pump_data();
+}
+
+void http2_connection::impl::process_input()
+{
+	if (!preface_received)
+	{
+		std::string_view buf = reader.buffered();
+		size_t len = (std::min)(buf.size(), http2_client_preface_size);
+		if (memcmp(buf.data(), http2_client_preface, len) != 0)
+			this->connection_error(error_code::protocol_error);
+		if (len < http2_client_preface_size)
+			return;
+
+		reader.consume(http2_client_preface_size);
+		preface_received = true;
+	}
+
+	for (;;)
+	{
+		http2_frame frame;
+		http2_read_result r = reader.next(frame, client_settings.max_frame_size);
+		if (r == http2_read_result::incomplete)
+			break;
+		if (r == http2_read_result::frame_too_large)
+			this->connection_error(error_code::frame_size_error);
+
+		this->process_frame(frame);
+	}
+}
+
+void http2_connection::impl::process_frame(http2_frame & frame)
+{
+	// A header block must not be interleaved with any other frame.
+	if (continued_stream != 0)
+	{
+		if (frame.type != frame_type::continuation || frame.stream_id != continued_stream)
+			this->connection_error(error_code::protocol_error);
+
+		header_block_size += frame.payload_size;
+		if (header_block_size > opts.max_header_block_size || ++continuation_frames > max_continuation_frames)
+			this->connection_error(error_code::enhance_your_calm);
+
+		this->on_header_fragment(frame.payload, (frame.flags & frame_flags::end_headers) != 0);
+		return;
+	}
+
+	switch (frame.type)
+	{
+	case frame_type::headers:
+		this->on_headers(frame);
+		break;
+	case frame_type::data:
+		this->on_data(frame);
+		break;
+	case frame_type::window_update:
+		this->on_window_update(frame);
+		break;
+	case frame_type::priority_update:
+		this->on_priority_update(frame);
+		break;
+	case frame_type::priority:
+		// RFC 7540 priorities are ignored in favor of RFC 9218 ones.
+		if (frame.stream_id == 0)
+			this->connection_error(error_code::protocol_error);
+		this->limit_rate(control_frames);
+		break;
+	case frame_type::push_promise:
+		// Only servers push.
+		this->connection_error(error_code::protocol_error);
+		break;
+	case frame_type::continuation:
+		// CONTINUATION frames are consumed along with their HEADERS frame.
+		this->connection_error(error_code::protocol_error);
+		break;
+	case frame_type::rst_stream:
+		this->on_rst_stream(frame);
+		break;
+	case frame_type::goaway:
+		this->on_goaway(frame);
+		break;
+	case frame_type::ping:
+		this->on_ping(frame);
+		break;
+	case frame_type::settings:
+		this->on_settings(frame);
+		break;
+	}
+}
+
+void http2_connection::impl::on_headers(http2_frame & frame)
+{
+	if (frame.stream_id == 0)
+		this->connection_error(error_code::protocol_error);
+
+	if ((frame.stream_id & 1) == 0)
+		this->connection_error(error_code::protocol_error);
+
+	char const * pl = frame.payload.data();
+	if (frame.flags & frame_flags::padded)
+	{
+		if (frame.payload_size < 1)
+			this->connection_error(error_code::protocol_error);
+
+		uint8_t pad_length = (uint8_t)*pl++;
+		--frame.payload_size;
+
+		if (frame.payload_size < pad_length)
+			this->connection_error(error_code::protocol_error);
+
+		frame.payload_size -= pad_length;
+	}
+
+	if (frame.flags & frame_flags::priority)
+	{
+		if (frame.payload_size < 5)
+			this->connection_error(error_code::protocol_error);
+
+		pl += 5;
+		frame.payload_size -= 5;
+	}
+
+	// A HEADERS frame on a stream that was already opened carries the
+	// trailers of the request. Streams that are not in the table anymore
+	// are closed.
+	continued_trailers = frame.stream_id < next_client_stream;
+	if (continued_trailers)
+	{
+		if (!streams.find(frame.stream_id))
+			this->connection_error(error_code::protocol_error);
+
+		continued_end_stream = (frame.flags & frame_flags::end_stream) != 0;
+	}
+	else
+	{
+		// Streams over the limit are refused, the client may retry them.
+		// So are the streams opened after the final GOAWAY.
+		continued_refused = streams.size() >= client_settings.max_concurrent_streams
+			|| drain == drain_phase::final;
+
+		auto & stream = streams.insert(frame.stream_id);
+		next_client_stream = frame.stream_id + 2;
+		stream.state = http2_stream_state::open;
+		stream.send_window = next_server_settings.initial_window_size;
+		stream.recv_window = client_settings.initial_window_size;
+
+		if (frame.flags & frame_flags::end_stream)
+			stream.close_remote();
+	}
+
+	header_block_size = frame.payload_size;
+	continuation_frames = 0;
+	if (header_block_size > opts.max_header_block_size)
+		this->connection_error(error_code::enhance_your_calm);
+
+	// The fragments of the header block are decoded as they arrive,
+	// a field split between frames is carried over by the decoder.
+	continued_stream = frame.stream_id;
+	this->on_header_fragment({ pl, frame.payload_size }, (frame.flags & frame_flags::end_headers) != 0);
+}
+
+void http2_connection::impl::on_header_fragment(std::string_view fragment, bool end_headers)
+{
+	uint32_t stream_id = continued_stream;
+	if (continued_trailers)
+	{
+		// The stream may be reclaimed while its trailers are decoded,
+		// they are kept apart from it.
+		header_list trailers(&trailer_arena);
+		bool ok = header_dec.decode(trailers, fragment, end_headers, trailer_arena);
+		trailers.clear();
+		trailer_arena.reset();
+
+		if (!ok)
+			this->connection_error(error_code::compression_error);
+
+		if (end_headers)
+		{
+			continued_stream = 0;
+			this->on_trailers(stream_id);
+		}
+		return;
+	}
+
+	http2_stream & stream = *streams.find(stream_id);
+
+	if (!header_dec.decode(stream.headers, fragment, end_headers, *stream.arena))
+		this->connection_error(error_code::compression_error);
+
+	if (!end_headers)
+		return;
+
+	continued_stream = 0;
+
+	if (continued_refused)
+	{
+		this->stream_error(stream_id, stream, error_code::refused_stream);
+		return;
+	}
+
+	this->accept_request(stream_id, stream, header_dec.list_size());
+}
+
+// Ends the request body once its trailers are decoded. The trailers
+// themselves are not passed to the handler.
+void http2_connection::impl::on_trailers(uint32_t stream_id)
+{
+	http2_stream * stream = streams.find(stream_id);
+	if (!stream || stream->reset)
+		return;
+
+	if (!stream->remote_open())
+	{
+		this->stream_error(stream_id, *stream, error_code::stream_closed);
+		return;
+	}
+
+	// Only the last header block may follow the body.
+	if (!continued_end_stream)
+	{
+		this->stream_error(stream_id, *stream, error_code::protocol_error);
+		return;
+	}
+
+	stream->close_remote();
+	this->reclaim(stream_id, *stream);
+}
+
+// Hands the request over once its headers are complete. The fields of
+// header lists larger than the limit were dropped, such requests are only
+// answered with 431.
+void http2_connection::impl::accept_request(uint32_t stream_id, http2_stream & stream, uint64_t list_size)
+{
+	if (list_size > opts.max_header_list_size)
+	{
+		last_stream_id = stream_id;
+		stream.discard_received = true;
+		this->send_response(stream_id, stream, response(431));
+		return;
+	}
+
+	for (auto const & h : stream.headers)
+	{
+		if (h.name == "priority")
+			parse_priority(stream.priority, h.value);
+	}
+
+	for (auto it = early_priorities.begin(); it != early_priorities.end(); ++it)
+	{
+		if (it->first == stream_id)
+		{
+			stream.priority = it->second;
+			early_priorities.erase(it);
+			break;
+		}
+	}
+
+	// Malformed requests only fail their own stream.
+	if (!make_request(stream.req, stream.headers, stream.arena))
+	{
+		this->stream_error(stream_id, stream, error_code::protocol_error);
+		return;
+	}
+
+	last_stream_id = stream_id;
+	ready_streams.push_back(stream_id);
+}
+
+void http2_connection::impl::on_data(http2_frame const & frame)
+{
+	if (frame.stream_id == 0)
+		this->connection_error(error_code::protocol_error);
+
+	// Streams that are not in the table are either idle or
+	// already closed and reclaimed.
+	http2_stream * stream = streams.find(frame.stream_id);
+	if (!stream && frame.stream_id >= next_client_stream)
+		this->connection_error(error_code::protocol_error);
+
+	// Padding counts against the flow control windows too.
+	std::string_view data = frame.payload;
+	if (frame.flags & frame_flags::padded)
+	{
+		if (data.empty())
+			this->connection_error(error_code::protocol_error);
+
+		uint8_t pad_length = (uint8_t)data[0];
+		data.remove_prefix(1);
+
+		if (data.size() < pad_length)
+			this->connection_error(error_code::protocol_error);
+
+		data.remove_suffix(pad_length);
+	}
+
+	// Empty frames don't count against the windows.
+	if (frame.payload_size == 0 && (frame.flags & frame_flags::end_stream) == 0)
+		this->limit_rate(control_frames);
+
+	if (frame.payload_size > conn_recv_window)
+		this->connection_error(error_code::flow_control_error);
+	conn_recv_window -= frame.payload_size;
+	conn_recv_unacked += frame.payload_size;
+	this->sample_bandwidth(frame.payload_size);
+
+	if (stream && !stream->reset)
+		this->receive_body(frame, *stream, data);
+
+	this->release_conn_window();
+}
+
+void http2_connection::impl::receive_body(http2_frame const & frame, http2_stream & stream, std::string_view data)
+{
+	if (!stream.remote_open())
+	{
+		this->stream_error(frame.stream_id, stream, error_code::stream_closed);
+		return;
+	}
+
+	if (frame.payload_size > stream.recv_window)
+	{
+		this->stream_error(frame.stream_id, stream, error_code::flow_control_error);
+		return;
+	}
+	stream.recv_window -= frame.payload_size;
+
+	if (stream.discard_received)
+	{
+		this->release_stream_window(frame.stream_id, stream, frame.payload_size);
+	}
+	else
+	{
+		if (stream.received_offset == stream.received.size())
+		{
+			stream.received.clear();
+			stream.received_offset = 0;
+		}
+
+		stream.received.append(data.data(), data.size());
+		buffered_body += data.size();
+		this->release_stream_window(frame.stream_id, stream, uint32_t(frame.payload_size - data.size()));
+	}
+
+	if (frame.flags & frame_flags::end_stream)
+	{
+		stream.close_remote();
+		this->reclaim(frame.stream_id, stream);
+	}
+}
+
+void http2_connection::impl::on_window_update(http2_frame const & frame)
+{
+	if (frame.payload_size != 4)
+		this->connection_error(error_code::frame_size_error);
+
+	uint32_t increment = load_be<uint32_t>(frame.payload.data()) & 0x7fffffff;
+
+	if (frame.stream_id == 0)
+	{
+		if (increment == 0)
+			this->connection_error(error_code::protocol_error);
+
+		conn_send_window += increment;
+		if (conn_send_window > max_window_size)
+			this->connection_error(error_code::flow_control_error);
+	}
+	else if (http2_stream * stream = streams.find(frame.stream_id))
+	{
+		if (stream->reset)
+			return;
+
+		if (increment == 0)
+		{
+			this->stream_error(frame.stream_id, *stream, error_code::protocol_error);
+			return;
+		}
+
+		stream->send_window += increment;
+		if (stream->send_window > max_window_size)
+		{
+			this->stream_error(frame.stream_id, *stream, error_code::flow_control_error);
+			return;
+		}
+
+		this->schedule(frame.stream_id, *stream);
+	}
+	else if (frame.stream_id >= next_client_stream)
+	{
+		this->connection_error(error_code::protocol_error);
+	}
+
+	this->pump_data();
+}
+
+void http2_connection::impl::on_priority_update(http2_frame const & frame)
+{
+	if (frame.stream_id != 0)
+		this->connection_error(error_code::protocol_error);
+	if (frame.payload_size < 4)
+		this->connection_error(error_code::frame_size_error);
+
+	uint32_t prioritized_id = load_be<uint32_t>(frame.payload.data()) & 0x7fffffff;
+	if (prioritized_id == 0 || (prioritized_id & 1) == 0)
+		this->connection_error(error_code::protocol_error);
+
+	this->limit_rate(control_frames);
+
+	http2_priority prio;
+	parse_priority(prio, frame.payload.substr(4));
+
+	if (http2_stream * stream = streams.find(prioritized_id))
+	{
+		this->reprioritize(prioritized_id, *stream, prio);
+		this->pump_data();
+	}
+	else if (prioritized_id >= next_client_stream)
+	{
+		if (early_priorities.size() == max_early_priorities)
+			early_priorities.erase(early_priorities.begin());
+		early_priorities.emplace_back(prioritized_id, prio);
+	}
+}
+
+void http2_connection::impl::on_rst_stream(http2_frame const & frame)
+{
+	if (frame.stream_id == 0)
+		this->connection_error(error_code::protocol_error);
+	if (frame.payload_size != 4)
+		this->connection_error(error_code::frame_size_error);
+
+	// Streams opened and reset right away cost work without ever being
+	// answered.
+	if (http2_stream * stream = streams.find(frame.stream_id))
+	{
+		if (!stream->reset)
+		{
+			this->limit_rate(stream_resets);
+			this->close_stream(frame.stream_id, *stream);
+		}
+	}
+	else if (frame.stream_id >= next_client_stream)
+	{
+		this->connection_error(error_code::protocol_error);
+	}
+}
+
+// The server doesn't open streams of its own, so a GOAWAY from the client
+// doesn't affect anything in flight.
+void http2_connection::impl::on_goaway(http2_frame const & frame)
+{
+	if (frame.stream_id != 0)
+		this->connection_error(error_code::protocol_error);
+	if (frame.payload_size < 8)
+		this->connection_error(error_code::frame_size_error);
+}
+
+void http2_connection::impl::on_ping(http2_frame const & frame)
+{
+	if (frame.stream_id != 0)
+		this->connection_error(error_code::protocol_error);
+	if (frame.payload_size != 8)
+		this->connection_error(error_code::frame_size_error);
+
+	if ((frame.flags & frame_flags::ack) == 0)
+	{
+		this->limit_rate(control_frames);
+		this->send_reply(frame_type::ping, frame_flags::ack, 0, frame.payload);
+	}
+	else if (bdp_ping_pending && frame.payload == std::string_view(bdp_ping, sizeof bdp_ping))
+	{
+		auto sample = std::chrono::steady_clock::now() - bdp_ping_sent;
+		rtt = rtt.count() == 0? sample: (rtt * 7 + sample) / 8;
+
+		bdp_ping_pending = false;
+		this->grow_recv_windows(bdp_bytes);
+	}
+	else if (drain == drain_phase::announced && frame.payload == std::string_view(drain_ping, sizeof drain_ping))
+	{
+		this->send_goaway(last_stream_id, error_code::no_error);
+		drain = drain_phase::final;
+	}
+}
+
+void http2_connection::impl::on_settings(http2_frame const & frame)
+{
+	if (frame.stream_id != 0)
+		this->connection_error(error_code::protocol_error);
+
+	if (frame.flags & frame_flags::ack)
+	{
+		if (frame.payload_size != 0)
+			this->connection_error(error_code::frame_size_error);
+		if (client_settings_in_flight.empty())
+			this->connection_error(error_code::protocol_error);
+
+		this->apply_client_settings(client_settings_in_flight.front());
+		client_settings_in_flight.pop_front();
+		return;
+	}
+
+	this->limit_rate(control_frames);
+	this->apply_server_settings(frame.payload);
+	this->send_reply(frame_type::settings, frame_flags::ack, 0, "");
+
+	this->pump_data();
+}
+
+// Takes the client's settings into account, they are acknowledged by
+// the caller.
+void http2_connection::impl::apply_server_settings(std::string_view payload)
+{
+	endpoint_settings new_server_settings = next_server_settings;
+
+	size_t idx = 0;
+	for (; idx < payload.size(); idx += 6)
+	{
+		auto id = static_cast<settings_ids>(load_be<uint16_t>(payload.data() + idx));
+		uint32_t value = load_be<uint32_t>(payload.data() + idx + 2);
+
+		switch (id)
+		{
+		case settings_ids::header_table_size:
+			new_server_settings.header_table_size = value;
+			break;
+		case settings_ids::enable_push:
+			if (value != 0 && value != 1)
+				this->connection_error(error_code::protocol_error);
+			new_server_settings.enable_push = value != 0;
+			break;
+		case settings_ids::max_concurrent_streams:
+			new_server_settings.max_concurrent_streams = value;
+			break;
+		case settings_ids::initial_window_size:
+			if (value > 0x7fffffff)
+				this->connection_error(error_code::flow_control_error);
+			new_server_settings.initial_window_size = value;
+			break;
+		case settings_ids::max_frame_size:
+			if (value < 16384 || value >= (1 << 24))
+				this->connection_error(error_code::protocol_error);
+			new_server_settings.max_frame_size = value;
+			break;
+		case settings_ids::max_header_list_size:
+			new_server_settings.max_header_list_size = value;
+			break;
+		case settings_ids::no_rfc7540_priorities:
+			// Priorities are taken from the priority header either way.
+			if (value != 0 && value != 1)
+				this->connection_error(error_code::protocol_error);
+			break;
+		}
+	}
+
+	if (idx != payload.size())
+		this->connection_error(error_code::frame_size_error);
+
+	// A change of the initial window size applies retroactively
+	// to all open streams.
+	int64_t window_delta = int64_t(new_server_settings.initial_window_size) - next_server_settings.initial_window_size;
+	if (window_delta != 0)
+	{
+		streams.for_each([&](uint32_t stream_id, http2_stream & stream) {
+			stream.send_window += window_delta;
+			if (stream.send_window > max_window_size)
+				this->connection_error(error_code::flow_control_error);
+			this->schedule(stream_id, stream);
+		});
+	}
+
+	// The new settings apply to everything sent after the
+	// acknowledgement, header blocks included.
+	next_server_settings = new_server_settings;
+	header_enc.set_max_capacity(new_server_settings.header_table_size);
+}
+
+http2_connection_error::http2_connection_error(uint32_t code)
+	: std::runtime_error("HTTP/2 connection error " + std::to_string(code)), code(code)
+{
+}
+
+http2_connection::http2_connection(http2_options const & opts)
+	: pimpl_(new impl(opts))
+{
+}
+
+http2_connection::~http2_connection()
+{
+}
+
+char * http2_connection::input_buffer(size_t & len)
+{
+	return pimpl_->reader.prepare(len);
+}
+
+void http2_connection::commit_input(size_t len)
+{
+	pimpl_->reader.commit(len);
+	pimpl_->process_input();
+}
+
+void http2_connection::feed(char const * data, size_t len)
+{
+	while (len)
+	{
+		size_t buf_len;
+		char * buf = this->input_buffer(buf_len);
+
+		size_t chunk = (std::min)(len, buf_len);
+		memcpy(buf, data, chunk);
+		this->commit_input(chunk);
+
+		data += chunk;
+		len -= chunk;
+	}
+}
+
+void http2_connection::upgrade(std::string_view settings, request const & req)
+{
+	impl & p = *pimpl_;
+
+	// The 101 response acknowledges the settings.
+	p.apply_server_settings(settings);
+
+	http2_stream & stream = p.streams.insert(1);
+	p.next_client_stream = 3;
+	stream.state = http2_stream_state::open;
+	stream.send_window = p.next_server_settings.initial_window_size;
+	stream.recv_window = p.client_settings.initial_window_size;
+	stream.close_remote();
+
+	// The request refers to the caller's memory, it is copied to the
+	// stream's arena. Field names are lowercase in HTTP/2.
+	auto copy = [&](std::string_view str, bool lowercase) {
+		char * r = static_cast<char *>(stream.arena->allocate(str.size(), 1));
+		std::transform(str.begin(), str.end(), r, [&](char ch) {
+			return lowercase && 'A' <= ch && ch <= 'Z'? char(ch - 'A' + 'a'): ch;
+		});
+		return std::string_view(r, str.size());
+	};
+
+	stream.headers.push_back({ ":method", copy(req.method, false) });
+	stream.headers.push_back({ ":scheme", "http" });
+	stream.headers.push_back({ ":path", copy(req.path, false) });
+
+	uint64_t list_size = 0;
+	for (auto const & h : req.headers)
+	{
+		if (is_connection_header(h.name) || compare_header_name(h.name, "http2-settings") == 0)
+			continue;
+
+		stream.headers.push_back({ copy(h.name, true), copy(h.value, false) });
+		list_size += h.name.size() + h.value.size() + 32;
+	}
+
+	p.accept_request(1, stream, list_size);
+}
+
+bool http2_connection::next_request(uint32_t & stream_id, request & req)
+{
+	while (!pimpl_->ready_streams.empty())
+	{
+		stream_id = pimpl_->ready_streams.front();
+		pimpl_->ready_streams.pop_front();
+
+		// The stream may have been reset before its request was taken.
+		http2_stream * stream = pimpl_->streams.find(stream_id);
+		if (!stream || stream->reset)
+			continue;
+
+		req = std::move(stream->req);
+		stream->handler_active = true;
+		return true;
+	}
+
+	return false;
+}
+
+size_t http2_connection::read_body(uint32_t stream_id, char * buf, size_t len)
+{
+	http2_stream * stream = pimpl_->streams.find(stream_id);
+	if (!stream)
+		return 0;
+
+	len = (std::min)(len, stream->received.size() - stream->received_offset);
+	memcpy(buf, stream->received.data() + stream->received_offset, len);
+	stream->received_offset += len;
+
+	pimpl_->buffered_body -= len;
+	if (len == 0 && stream->remote_open())
+		pimpl_->refuse_queued_bodies();
+	pimpl_->release_conn_window();
+
+	pimpl_->release_stream_window(stream_id, *stream, uint32_t(len));
+	return len;
+}
+
+bool http2_connection::stream_reset(uint32_t stream_id) const
+{
+	http2_stream * stream = pimpl_->streams.find(stream_id);
+	return !stream || stream->reset;
+}
+
+bool http2_connection::body_complete(uint32_t stream_id) const
+{
+	http2_stream * stream = pimpl_->streams.find(stream_id);
+	return !stream || (!stream->remote_open() && stream->received_offset == stream->received.size());
+}
+
+void http2_connection::submit_response(uint32_t stream_id, response resp)
+{
+	http2_stream * stream = pimpl_->streams.find(stream_id);
+	if (!stream)
+		return;
+
+	stream->handler_active = false;
+	if (stream->reset || pimpl_->failed)
+	{
+		pimpl_->reclaim(stream_id, *stream);
+		return;
+	}
+
+	pimpl_->discard_received(stream_id, *stream);
+	pimpl_->send_response(stream_id, *stream, std::move(resp));
+}
+
+void http2_connection::reset_stream(uint32_t stream_id)
+{
+	http2_stream * stream = pimpl_->streams.find(stream_id);
+	if (!stream)
+		return;
+
+	stream->handler_active = false;
+	if (stream->reset || pimpl_->failed)
+	{
+		pimpl_->reclaim(stream_id, *stream);
+		return;
+	}
+
+	pimpl_->send_rst_stream(stream_id, error_code::internal_error);
+	pimpl_->close_stream(stream_id, *stream);
+}
+
+void http2_connection::shutdown()
+{
+	pimpl_->start_drain();
+}
+
+bool http2_connection::finished() const
+{
+	return pimpl_->failed
+		|| (pimpl_->drain == impl::drain_phase::final && pimpl_->streams.size() == 0 && pimpl_->ready_streams.empty());
+}
+
+std::chrono::steady_clock::duration http2_connection::rtt() const
+{
+	return pimpl_->rtt;
+}
+
+bool http2_connection::has_output() const
+{
+	return !pimpl_->send_queue.empty();
+}
+
+size_t http2_connection::output(std::string_view * bufs, size_t count) const
+{
+	return pimpl_->send_queue.gather(bufs, count);
+}
+
+void http2_connection::consume_output(size_t len)
+{
+	pimpl_->send_queue.consume(len);
+	pimpl_->pump_data();
+}
@@ -0,0 +1,155 @@
+#include "http2_frame.hpp"
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+static size_t const frame_header_size = 9;
+
+namespace {
+
+// Keeps a few released buffers around for the next connection that needs
+// one of the same size. Sizes are rounded to powers of two to make reuse
+// likely.
+struct buffer_pool
+{
+	enum { max_buffers = 16 };
+
+	struct entry
+	{
+		char * buf;
+		size_t size;
+	};
+
+	~buffer_pool()
+	{
+		for (auto const & e : free_)
+			::operator delete(e.buf);
+	}
+
+	char * acquire(size_t & size)
+	{
+		size_t rounded = 4096;
+		while (rounded < size)
+			rounded *= 2;
+		size = rounded;
+
+		{
+			std::lock_guard<std::mutex> l(mutex_);
+			for (size_t i = 0; i != free_.size(); ++i)
+			{
+				if (free_[i].size == size)
+				{
+					char * r = free_[i].buf;
+					free_[i] = free_.back();
+					free_.pop_back();
+					return r;
+				}
+			}
+		}
+
+		return static_cast<char *>(::operator new(size));
+	}
+
+	void release(char * buf, size_t size)
+	{
+		{
+			std::lock_guard<std::mutex> l(mutex_);
+			if (free_.size() < max_buffers)
+			{
+				free_.push_back({ buf, size });
+				return;
+			}
+		}
+
+		::operator delete(buf);
+	}
+
+private:
+	std::mutex mutex_;
+	std::vector<entry> free_;
+};
+
+}
+
+static buffer_pool g_buffer_pool;
+
+http2_frame_reader::http2_frame_reader(size_t buffer_size)
+	: buf_(nullptr), size_(buffer_size), first_(0), last_(0), needed_(0)
+{
+	buf_ = g_buffer_pool.acquire(size_);
+	default_size_ = size_;
+}
+
+http2_frame_reader::~http2_frame_reader()
+{
+	g_buffer_pool.release(buf_, size_);
+}
+
+void http2_frame_reader::realloc(size_t size)
+{
+	char * buf = g_buffer_pool.acquire(size);
+	std::memcpy(buf, buf_ + first_, last_ - first_);
+	g_buffer_pool.release(buf_, size_);
+
+	buf_ = buf;
+	size_ = size;
+	last_ -= first_;
+	first_ = 0;
+}
+
+char * http2_frame_reader::prepare(size_t & len)
+{
+	if (first_ == last_)
+	{
+		first_ = last_ = 0;
+
+		// A grown buffer is given back once it is drained.
+		if (size_ != default_size_ && needed_ <= default_size_)
+			this->realloc(default_size_);
+	}
+
+	if (needed_ > size_)
+	{
+		this->realloc(needed_);
+	}
+	else if (last_ == size_ || first_ + needed_ > size_)
+	{
+		std::memmove(buf_, buf_ + first_, last_ - first_);
+		last_ -= first_;
+		first_ = 0;
+	}
+
+	len = size_ - last_;
+	return buf_ + last_;
+}
+
+void http2_frame_reader::commit(size_t len)
+{
+	last_ += len;
+}
+
+http2_read_result http2_frame_reader::next(http2_frame & frame, uint32_t max_payload_size)
+{
+	needed_ = frame_header_size;
+	if (last_ - first_ < frame_header_size)
+		return http2_read_result::incomplete;
+
+	char const * header = buf_ + first_;
+	frame.payload_size = load_be<uint32_t>(header, 3);
+	frame.type = static_cast<frame_type>(header[3]);
+	frame.flags = static_cast<frame_flags>(header[4]);
+	frame.stream_id = load_be<uint32_t>(header + 5) & 0x7fffffff;
+	frame.payload = {};
+
+	if (frame.payload_size > max_payload_size)
+		return http2_read_result::frame_too_large;
+
+	needed_ = frame_header_size + frame.payload_size;
+	if (last_ - first_ < needed_)
+		return http2_read_result::incomplete;
+
+	frame.payload = { buf_ + first_ + frame_header_size, frame.payload_size };
+	first_ += needed_;
+	needed_ = 0;
+	return http2_read_result::ok;
+}
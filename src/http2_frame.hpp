@@ -0,0 +1,160 @@
+#ifndef HTTP2_FRAME_HPP
+#define HTTP2_FRAME_HPP
+
+#include <cstdint>
+#include <string_view>
+
+// Every HTTP/2 connection starts with the client sending this.
+static char const http2_client_preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static size_t const http2_client_preface_size = sizeof http2_client_preface - 1;
+
+enum class frame_type : char
+{
+	data = 0,
+	headers = 1,
+	priority = 2,
+	rst_stream = 3,
+	settings = 4,
+	push_promise = 5,
+	ping = 6,
+	goaway = 7,
+	window_update = 8,
+	continuation = 9,
+	priority_update = 16,
+};
+
+enum frame_flags : char
+{
+	ack = 0x01,
+	end_stream = 0x01,
+	end_headers = 0x04,
+	padded = 0x08,
+	priority = 0x20,
+};
+
+enum settings_ids : char
+{
+	header_table_size = 1,
+	enable_push = 2,
+	max_concurrent_streams = 3,
+	initial_window_size = 4,
+	max_frame_size = 5,
+	max_header_list_size = 6,
+	no_rfc7540_priorities = 9,
+};
+
+enum class error_code : uint32_t
+{
+	no_error = 0,
+	protocol_error = 1,
+	internal_error = 2,
+	flow_control_error = 3,
+	settings_timeout = 4,
+	stream_closed = 5,
+	frame_size_error = 6,
+	refused_stream = 7,
+	cancel = 8,
+	compression_error = 9,
+	connect_error = 10,
+	enhance_your_calm = 11,
+	inadequate_security = 12,
+	http_1_1_required = 13,
+};
+
+template <typename T>
+void store_be(char * buf, T value, size_t len = sizeof(T))
+{
+	while (len)
+	{
+		buf[--len] = (char)value;
+		value >>= 8;
+	}
+}
+
+template <typename T>
+T load_be(char const * buf, size_t len = sizeof(T))
+{
+	T r = 0;
+	while (len)
+	{
+		r = (r << 8) | uint8_t(*buf++);
+		--len;
+	}
+	return r;
+}
+
+template <typename T>
+void load_be(T & v, char const * buf, size_t len = sizeof(T))
+{
+	v = load_be<T>(buf, len);
+}
+
+struct http2_frame
+{
+	uint32_t payload_size;
+	frame_type type;
+	frame_flags flags;
+	uint32_t stream_id;
+	std::string_view payload;
+};
+
+enum class http2_read_result
+{
+	ok,
+	incomplete,
+	frame_too_large,
+};
+
+// Splits received bytes into frames.
+//
+// Bytes are read straight into the reader's buffer through `prepare` and
+// `commit`, so that a single read of the transport can carry a burst of
+// small frames. Frame payloads are views into the buffer and stay valid
+// until the next call to `prepare` or `next`.
+//
+// The buffer grows to hold frames larger than `buffer_size` and shrinks
+// back once such a frame is consumed. Large buffers are recycled through
+// a process-wide pool.
+struct http2_frame_reader
+{
+	explicit http2_frame_reader(size_t buffer_size = 64 * 1024);
+	~http2_frame_reader();
+
+	http2_frame_reader(http2_frame_reader const &) = delete;
+	http2_frame_reader & operator=(http2_frame_reader const &) = delete;
+
+	// Returns space for at least one byte of input, `len` is set to its size.
+	char * prepare(size_t & len);
+	void commit(size_t len);
+
+	// Returns the bytes that are buffered but not yet parsed.
+	std::string_view buffered() const
+	{
+		return { buf_ + first_, last_ - first_ };
+	}
+
+	// Removes bytes from the front of the buffer, such as the connection
+	// preface.
+	void consume(size_t len)
+	{
+		first_ += len;
+	}
+
+	// Returns the next complete frame. Fails with `frame_too_large` without
+	// consuming the frame if its payload exceeds `max_payload_size`.
+	http2_read_result next(http2_frame & frame, uint32_t max_payload_size);
+
+private:
+	void realloc(size_t size);
+
+	char * buf_;
+	size_t size_;
+	size_t default_size_;
+	size_t first_;
+	size_t last_;
+
+	// The size of the frame that didn't fit in the buffer.
+	size_t needed_;
+};
+
+#endif // HTTP2_FRAME_HPP
@@ -0,0 +1,97 @@
+#include "http2_output.hpp"
+#include <cstring>
+#include <memory>
+#include <string>
+
+http2_output_queue::http2_output_queue()
+	: size_(0), offset_(0)
+{
+}
+
+http2_output_queue::entry & http2_output_queue::push_header(frame_type type, char flags, uint32_t stream_id, size_t payload_size)
+{
+	entries_.emplace_back();
+	entry & e = entries_.back();
+
+	store_be(e.header, payload_size, 3);
+	e.header[3] = static_cast<char>(type);
+	e.header[4] = flags;
+	store_be(&e.header[5], stream_id);
+	e.header_size = 9;
+
+	size_ += 9 + payload_size;
+	return e;
+}
+
+void http2_output_queue::push(frame_type type, char flags, uint32_t stream_id, std::string_view payload)
+{
+	if (payload.size() <= inline_capacity)
+	{
+		entry & e = this->push_header(type, flags, stream_id, payload.size());
+		std::memcpy(e.header + 9, payload.data(), payload.size());
+		e.header_size += (uint8_t)payload.size();
+		return;
+	}
+
+	auto copy = std::make_shared<std::string>(payload.data(), payload.size());
+	std::string_view view = *copy;
+	this->push(type, flags, stream_id, view, std::move(copy));
+}
+
+void http2_output_queue::push(frame_type type, char flags, uint32_t stream_id, std::string_view payload, std::shared_ptr<void> owner)
+{
+	entry & e = this->push_header(type, flags, stream_id, payload.size());
+	e.payload = payload;
+	e.owner = std::move(owner);
+}
+
+size_t http2_output_queue::gather(std::string_view * bufs, size_t count) const
+{
+	size_t skip = offset_;
+	size_t r = 0;
+	for (auto const & e : entries_)
+	{
+		if (r + 2 > count)
+			break;
+
+		std::string_view header(e.header, e.header_size);
+		std::string_view payload = e.payload;
+		if (skip >= header.size())
+		{
+			skip -= header.size();
+			header = {};
+			payload.remove_prefix(skip);
+		}
+		else
+		{
+			header.remove_prefix(skip);
+		}
+		skip = 0;
+
+		if (!header.empty())
+			bufs[r++] = header;
+		if (!payload.empty())
+			bufs[r++] = payload;
+	}
+
+	return r;
+}
+
+void http2_output_queue::consume(size_t len)
+{
+	size_ -= len;
+	len += offset_;
+
+	while (!entries_.empty())
+	{
+		entry const & e = entries_.front();
+		size_t frame_size = e.header_size + e.payload.size();
+		if (len < frame_size)
+			break;
+
+		len -= frame_size;
+		entries_.pop_front();
+	}
+
+	offset_ = len;
+}
@@ -0,0 +1,62 @@
+#ifndef HTTP2_OUTPUT_HPP
+#define HTTP2_OUTPUT_HPP
+
+#include "http2_frame.hpp"
+#include <deque>
+#include <memory>
+
+// A queue of outgoing frames.
+//
+// Frame headers and small payloads are stored in the queue itself, larger
+// payloads are referenced and kept alive by a shared owner until they are
+// written. `gather` collects as many frames as fit into a single vectored
+// write.
+struct http2_output_queue
+{
+	enum { inline_capacity = 40 };
+
+	http2_output_queue();
+
+	// Queues a frame, copying the payload.
+	void push(frame_type type, char flags, uint32_t stream_id, std::string_view payload);
+
+	// Queues a frame whose payload stays valid for as long as `owner` lives.
+	void push(frame_type type, char flags, uint32_t stream_id, std::string_view payload, std::shared_ptr<void> owner);
+
+	bool empty() const
+	{
+		return entries_.empty();
+	}
+
+	// The number of bytes waiting to be written.
+	size_t size() const
+	{
+		return size_;
+	}
+
+	// Fills `bufs` with the unwritten parts of the queued frames and returns
+	// the number of buffers used.
+	size_t gather(std::string_view * bufs, size_t count) const;
+
+	// Removes `len` written bytes from the front of the queue.
+	void consume(size_t len);
+
+private:
+	struct entry
+	{
+		char header[9 + inline_capacity];
+		uint8_t header_size;
+		std::string_view payload;
+		std::shared_ptr<void> owner;
+	};
+
+	entry & push_header(frame_type type, char flags, uint32_t stream_id, size_t payload_size);
+
+	std::deque<entry> entries_;
+	size_t size_;
+
+	// The number of bytes of the first frame that were already written.
+	size_t offset_;
+};
+
+#endif // HTTP2_OUTPUT_HPP
@@ -0,0 +1,134 @@
+#include "http2_scheduler.hpp"
+#include <string_utils.hpp>
+#include <algorithm>
+
+// The value is a structured field dictionary (RFC 8941), only the `u`
+// and `i` members are recognized.
+void parse_priority(http2_priority & prio, std::string_view value)
+{
+	while (!value.empty())
+	{
+		size_t comma = value.find(',');
+		std::string_view member = strip(value.substr(0, comma));
+		value = comma == std::string_view::npos? std::string_view(): value.substr(comma + 1);
+
+		size_t params = member.find(';');
+		if (params != std::string_view::npos)
+			member = member.substr(0, params);
+
+		std::string_view key = member;
+		std::string_view item;
+
+		size_t eq = member.find('=');
+		if (eq != std::string_view::npos)
+		{
+			key = strip(member.substr(0, eq));
+			item = strip(member.substr(eq + 1));
+		}
+
+		if (key == "u")
+		{
+			if (item.size() == 1 && item[0] >= '0' && item[0] < '0' + http2_priority::levels)
+				prio.urgency = uint8_t(item[0] - '0');
+		}
+		else if (key == "i")
+		{
+			if (item.empty() || item == "?1")
+				prio.incremental = true;
+			else if (item == "?0")
+				prio.incremental = false;
+		}
+	}
+}
+
+http2_scheduler::http2_scheduler()
+	: size_(0), cur_level_(nullptr), cur_incremental_(false)
+{
+}
+
+bool http2_scheduler::empty() const
+{
+	return size_ == 0;
+}
+
+void http2_scheduler::schedule(uint32_t stream_id, http2_priority prio)
+{
+	level & l = levels_[prio.urgency < http2_priority::levels? prio.urgency: http2_priority::levels - 1];
+	if (prio.incremental)
+	{
+		l.incremental.push_back(stream_id);
+	}
+	else
+	{
+		auto it = std::lower_bound(l.sequential.begin(), l.sequential.end(), stream_id);
+		l.sequential.insert(it, stream_id);
+	}
+
+	++size_;
+}
+
+void http2_scheduler::unschedule(uint32_t stream_id)
+{
+	for (auto & l : levels_)
+	{
+		auto it = std::find(l.sequential.begin(), l.sequential.end(), stream_id);
+		if (it != l.sequential.end())
+		{
+			l.sequential.erase(it);
+			--size_;
+			return;
+		}
+
+		auto it2 = std::find(l.incremental.begin(), l.incremental.end(), stream_id);
+		if (it2 != l.incremental.end())
+		{
+			l.incremental.erase(it2);
+			--size_;
+			return;
+		}
+	}
+}
+
+uint32_t http2_scheduler::next()
+{
+	for (auto & l : levels_)
+	{
+		cur_level_ = &l;
+		if (!l.sequential.empty())
+		{
+			cur_incremental_ = false;
+			return l.sequential.front();
+		}
+
+		if (!l.incremental.empty())
+		{
+			cur_incremental_ = true;
+			return l.incremental.front();
+		}
+	}
+
+	cur_level_ = nullptr;
+	return 0;
+}
+
+void http2_scheduler::advance(bool more)
+{
+	if (!cur_level_)
+		return;
+
+	if (cur_incremental_)
+	{
+		uint32_t stream_id = cur_level_->incremental.front();
+		cur_level_->incremental.pop_front();
+		if (more)
+			cur_level_->incremental.push_back(stream_id);
+	}
+	else if (!more)
+	{
+		cur_level_->sequential.erase(cur_level_->sequential.begin());
+	}
+
+	if (!more)
+		--size_;
+	cur_level_ = nullptr;
+}
@@ -0,0 +1,60 @@
+#ifndef HTTP2_SCHEDULER_HPP
+#define HTTP2_SCHEDULER_HPP
+
+#include <cstdint>
+#include <deque>
+#include <string_view>
+#include <vector>
+
+// An RFC 9218 priority signal.
+struct http2_priority
+{
+	enum { levels = 8 };
+
+	uint8_t urgency = 3;
+	bool incremental = false;
+};
+
+// Parses the value of a `priority` header or PRIORITY_UPDATE frame into
+// `prio`. Unknown and malformed parameters are ignored, so parsing never
+// fails; parameters that are absent are left untouched.
+void parse_priority(http2_priority & prio, std::string_view value);
+
+// Decides which stream the next DATA frame belongs to.
+//
+// Urgency levels are served strictly in order. Within a level, streams
+// that are not incremental are sent one at a time in the order of their
+// identifiers, incremental streams then share the bandwidth round-robin,
+// one frame each.
+struct http2_scheduler
+{
+	http2_scheduler();
+
+	bool empty() const;
+
+	// Adds a stream that has data to send. A stream must not be scheduled
+	// more than once.
+	void schedule(uint32_t stream_id, http2_priority prio);
+	void unschedule(uint32_t stream_id);
+
+	// Returns the stream that should send the next frame, or zero. After
+	// sending, `advance` must be called before the next call to `next`;
+	// `more` keeps the stream scheduled.
+	uint32_t next();
+	void advance(bool more);
+
+private:
+	struct level
+	{
+		std::vector<uint32_t> sequential;
+		std::deque<uint32_t> incremental;
+	};
+
+	level levels_[http2_priority::levels];
+	size_t size_;
+
+	level * cur_level_;
+	bool cur_incremental_;
+};
+
+#endif // HTTP2_SCHEDULER_HPP
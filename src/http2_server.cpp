@@ -1,411 +1,400 @@
-#include "http_server.hpp"
-#include "hpack.hpp"
-#include <thread>
-#include <atomic>
+#include "http2_server.hpp"
+#include "http_stop_token.hpp"
+#include "http_worker_pool.hpp"
+#include "http2_connection.hpp"
 #include <condition_variable>
 #include <mutex>
-#include <deque>
-#include <map>
+#include <stdexcept>
 
-struct endpoint_settings
-{
-	uint32_t header_table_size = 4096;
-	bool enable_push = true;
-	uint32_t max_concurrent_streams = (uint32_t)-1;
-	int32_t initial_window_size = 65535;
-	uint32_t max_frame_size = 16384;
-	uint32_t max_header_list_size = (uint32_t)-1;
-};
-
-enum class frame_type : char
-{
-	data = 0,
-	headers = 1,
-	priority = 2,
-	rst_stream = 3,
-	settings = 4,
-	push_promise = 5,
-	ping = 6,
-	goaway = 7,
-	window_update = 8,
-	continuation = 9,
-};
+namespace {
 
-enum frame_flags : char
+// The connection shared by the reading thread and the handlers.
+//
+// `mutex` guards the connection. Output is written by whichever thread
+// holds `write_mutex`, without holding `mutex` during the write, so that
+// a handler finishing while another response is being written only queues
+// its frames. Responses thus go out in the order the handlers complete.
+struct connection_io
 {
-	ack = 0x01,
-	end_stream = 0x01,
-	end_headers = 0x04,
-	padded = 0x08,
-	priority = 0x20,
-};
+	connection_io(istream & in, ostream & out, http2_connection & conn, http_worker_pool * pool, http_connection_info const * info)
+		: in(in), out(out), vout(dynamic_cast<vectored_ostream *>(&out)), conn(conn), pool(pool), info(info),
+		active_handlers(0), input_closed(false)
+	{
+	}
 
-enum settings_ids : char
-{
-	header_table_size = 1,
-	enable_push = 2,
-	max_concurrent_streams = 3,
-	initial_window_size = 4,
-	max_frame_size = 5,
-	max_header_list_size = 6,
-};
+	// Writes everything queued, a write carries as many frames as fit.
+	void flush()
+	{
+		std::unique_lock<std::mutex> wl(write_mutex);
+		std::unique_lock<std::mutex> l(mutex);
+		this->write_output(l);
 
-enum class error_code : uint32_t
-{
-	no_error = 0,
-	protocol_error = 1,
-	internal_error = 2,
-	flow_control_error = 3,
-	settings_timeout = 4,
-	stream_closed = 5,
-	frame_size_error = 6,
-	refused_stream = 7,
-	cancel = 8,
-	compression_error = 9,
-	connect_error = 10,
-	enhance_your_calm = 11,
-	inadequate_security = 12,
-	http_1_1_required = 13,
-};
+		// Released with `mutex` held, so that `try_flush` either gets
+		// the write lock or knows that the writer is yet to see its output.
+		wl.unlock();
+	}
 
-template <typename T>
-void store_be(char * buf, T value, size_t len = sizeof(T))
-{
-	while (len)
+	// Writes the queued output unless another thread is writing already,
+	// which then writes it too. `l` must hold `mutex`.
+	void try_flush(std::unique_lock<std::mutex> & l)
 	{
-		buf[--len] = (char)value;
-		value >>= 8;
+		std::unique_lock<std::mutex> wl(write_mutex, std::try_to_lock);
+		if (!wl)
+			return;
+
+		this->write_output(l);
+		wl.unlock();
 	}
-}
 
-template <typename T>
-T load_be(char const * buf, size_t len = sizeof(T))
-{
-	T r = 0;
-	while (len)
+	void write_output(std::unique_lock<std::mutex> & l)
 	{
-		r = (r << 8) | uint8_t(*buf++);
-		--len;
-	}
-	return r;
-}
+		while (conn.has_output())
+		{
+			std::string_view bufs[64];
+			size_t count = conn.output(bufs, 64);
+			l.unlock();
 
-template <typename T>
-void load_be(T & v, char const * buf, size_t len = sizeof(T))
-{
-	v = load_be<T>(buf, len);
-}
+			size_t len = 0;
+			if (vout)
+			{
+				len = vout->write_vec(bufs, count);
+			}
+			else
+			{
+				for (size_t i = 0; i != count; ++i)
+				{
+					out.write_all(bufs[i].data(), bufs[i].size());
+					len += bufs[i].size();
+				}
+			}
 
-template <typename F>
-struct on_exit_t
-{
-	explicit on_exit_t(F && f)
-		: f_(std::forward<F>(f)), armed_(true)
-	{
+			l.lock();
+			conn.consume_output(len);
+		}
 	}
 
-	on_exit_t(on_exit_t && o)
-		: f_(std::move(o.f_)), armed_(o.armed_)
+	bool next_request(uint32_t & stream_id, request & req)
 	{
-		o.armed_ = false;
+		std::lock_guard<std::mutex> l(mutex);
+		if (!conn.next_request(stream_id, req))
+			return false;
+
+		req.connection = info;
+		++active_handlers;
+		return true;
 	}
 
-	~on_exit_t()
+	void handler_done()
 	{
-		if (armed_)
-			f_();
+		std::lock_guard<std::mutex> l(mutex);
+		if (--active_handlers == 0)
+			handlers_done.notify_all();
 	}
 
-	F f_;
-	bool armed_;
-};
-
-template <typename F>
-auto on_exit(F && f)
-{
-	return on_exit_t<std::remove_const_t<std::remove_reference_t<F>>>(std::forward<F>(f));
-}
-
-struct http2_stream
-{
-	std::string header_block;
-	bool open_from_client = true;
-
-	void process_headers()
+	bool finished()
 	{
+		std::lock_guard<std::mutex> l(mutex);
+		return conn.finished();
 	}
-};
 
-struct http2_frame
-{
-	uint32_t payload_size;
-	frame_type type;
-	frame_flags flags;
-	uint32_t stream_id;
-};
+	// Blocks until more input arrives, returns false at the end of the stream.
+	bool fill()
+	{
+		char * buf;
+		size_t len;
+		{
+			std::lock_guard<std::mutex> l(mutex);
+			buf = conn.input_buffer(len);
+		}
 
-void http2_server(istream & in, ostream & out, std::function<response(request &&)> const & fn)
-{
-	static char const client_preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+		// Only this thread touches the input buffer.
+		len = in.read(buf, len);
+		if (len == 0)
+			return false;
 
-	std::map<uint32_t, http2_stream> streams;
-	uint32_t next_client_stream = 1;
+		std::lock_guard<std::mutex> l(mutex);
+		conn.commit_input(len);
+		input_ready.notify_all();
+		return true;
+	}
 
-	hpack_decoder header_dec(4096);
+	istream & in;
+	ostream & out;
+	vectored_ostream * vout;
+	http2_connection & conn;
+	http_worker_pool * pool;
+	http_connection_info const * info;
 
-	endpoint_settings next_server_settings;
-	endpoint_settings client_settings;
-	std::atomic<int> client_settings_in_flight(0);
+	std::mutex mutex;
+	std::mutex write_mutex;
 
-	auto send_frame = [&](frame_type type, char flags, uint32_t stream_id, std::string_view payload) {
-		char header[9];
-		store_be(header, payload.size(), 3);
-		header[3] = static_cast<char>(type);
-		header[4] = flags;
-		store_be(&header[5], stream_id);
+	// Handlers running on the pool wait here for their request body.
+	std::condition_variable input_ready;
 
-		out.write_all(header, sizeof header);
-		out.write_all(payload.data(), payload.size());
-	};
+	// The number of requests taken from the connection and not yet
+	// answered.
+	std::condition_variable handlers_done;
+	size_t active_handlers;
+	bool input_closed;
 
-	std::exception_ptr stream0_writer_error;
+	// Set if the connection failed while a handler was reading a body or
+	// writing, the handler may have swallowed the exception.
+	std::exception_ptr error;
+};
 
-	std::condition_variable send_ready;
-	std::mutex send_mutex;
-	bool send_done = false;
-	size_t setting_acks = 0;
-	std::deque<std::string> pings;
+// Reads a request body from DATA frames as the handler asks for it.
+//
+// A handler run inline serves the connection while it waits for data:
+// window updates go out and frames of other streams are buffered. A handler
+// on the pool waits for the reading thread instead.
+struct request_body_istream final
+	: istream
+{
+	request_body_istream(connection_io & io, uint32_t stream_id)
+		: io_(io), stream_id_(stream_id)
+	{
+	}
 
-	auto stream0_write = [&]() {
-		try
+	size_t read(char * buf, size_t len) override
+	{
+		for (;;)
 		{
-			std::unique_lock<std::mutex> l(send_mutex);
-
-			++client_settings_in_flight;
-			send_frame(frame_type::settings, 0, 0, "");
-
-			endpoint_settings server_settings;
-			while (!send_done)
+			bool flush;
 			{
-				if (!pings.empty())
+				std::unique_lock<std::mutex> l(io_.mutex);
+				if (io_.conn.stream_reset(stream_id_))
+					throw std::runtime_error("stream reset");
+
+				size_t r = io_.conn.read_body(stream_id_, buf, len);
+				if (r != 0 || len == 0 || io_.conn.body_complete(stream_id_))
+					return r;
+				if (io_.input_closed)
+					throw std::runtime_error("unexpected end of stream");
+
+				flush = io_.conn.has_output();
+				if (io_.pool && !flush)
 				{
-					auto const & ping = pings.front();
-					send_frame(frame_type::ping, frame_flags::ack, 0, ping);
-					pings.pop_front();
+					io_.input_ready.wait(l);
 					continue;
 				}
-
-				if (setting_acks)
-				{
-					server_settings = next_server_settings;
-					--setting_acks;
-					send_frame(frame_type::settings, frame_flags::ack, 0, "");
-					continue;
-				}
-
-				send_ready.wait(l);
 			}
-		}
-		catch (...)
-		{
-			stream0_writer_error = std::current_exception();
-		}
-	};
 
-	std::thread stream0_writer(stream0_write);
-	auto stream0_writer_canceller = on_exit([&] {
-		{
-			std::lock_guard<std::mutex> l(send_mutex);
-			send_done = true;
-			send_ready.notify_one();
+			try
+			{
+				if (flush)
+					io_.flush();
+				else if (!io_.fill())
+					throw std::runtime_error("unexpected end of stream");
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> l(io_.mutex);
+				if (!io_.error)
+					io_.error = std::current_exception();
+				throw;
+			}
 		}
+	}
 
-		stream0_writer.join();
-	});
-
-	char buf[16 * 1024];
-	in.read_all(buf, sizeof client_preface - 1);
-
-	if (memcmp(buf, client_preface, sizeof client_preface - 1) != 0)
-		throw std::runtime_error("invalid client preface");
-
-	auto connection_error = [&](error_code ec) {
-		throw std::runtime_error("connection error");
-	};
+private:
+	connection_io & io_;
+	uint32_t stream_id_;
+};
 
-	for (;;)
+struct stream_task
+{
+	stream_task(connection_io & io, uint32_t stream_id, request && req)
+		: stream_id(stream_id), req(std::move(req)), body(io, stream_id)
 	{
-		if (stream0_writer_error)
-			std::rethrow_exception(stream0_writer_error);
+		this->req.body = http_body(body);
+	}
 
-		char frame_header[9];
-		char payload[65536];
+	uint32_t stream_id;
+	request req;
 
-		auto read_frame = [&](char * buf, size_t len) {
-			in.read_all(frame_header, sizeof frame_header);
-			http2_frame frame;
-			frame.payload_size = load_be<uint32_t>(frame_header, 3);
-			frame.type = static_cast<frame_type>(frame_header[3]);
-			frame.flags = static_cast<frame_flags>(frame_header[4]);
-			frame.stream_id = load_be<uint32_t>(&frame_header[5]);
-			frame.stream_id &= 0x7fffffff;
+	// The body stream is only valid until the response is submitted.
+	request_body_istream body;
+};
 
-			if (frame.payload_size > len)
-				connection_error(error_code::frame_size_error);
+// Failures of the handler are answered with 500. The headers may already
+// be queued when submitting the response fails, the stream can then only
+// be reset.
+void run_handler(connection_io & io, stream_task & task, std::function<response(request &&)> const & fn)
+{
+	auto handle = [&]() -> response {
+		try
+		{
+			return fn(std::move(task.req));
+		}
+		catch (std::exception const & e)
+		{
+			return { e.what(), { { "content-type", "text/plain" } }, 500 };
+		}
+		catch (...)
+		{
+			return { 500 };
+		}
+	};
 
-			in.read_all(payload, frame.payload_size);
-			return frame;
-		};
+	response resp = handle();
 
-		http2_frame frame = read_frame(payload, client_settings.max_frame_size);
+	std::lock_guard<std::mutex> l(io.mutex);
+	try
+	{
+		io.conn.submit_response(task.stream_id, std::move(resp));
+	}
+	catch (http2_connection_error const &)
+	{
+		if (!io.error)
+			io.error = std::current_exception();
+	}
+	catch (...)
+	{
+		io.conn.reset_stream(task.stream_id);
+	}
+}
 
-		switch (frame.type)
+void serve_inline(connection_io & io, std::function<response(request &&)> const & fn)
+{
+	for (;;)
+	{
+		uint32_t stream_id;
+		request req;
+		while (io.next_request(stream_id, req))
 		{
-		case frame_type::headers:
-			if (frame.stream_id == 0)
-				connection_error(error_code::protocol_error);
+			stream_task task(io, stream_id, std::move(req));
+			run_handler(io, task, fn);
+			io.handler_done();
 
-			if ((frame.stream_id & 1) == 0)
-				connection_error(error_code::protocol_error);
+			if (io.error)
+				std::rethrow_exception(io.error);
+		}
 
-			if (frame.stream_id < next_client_stream)
-				connection_error(error_code::protocol_error);
+		io.flush();
+		if (io.finished() || !io.fill())
+			return;
+	}
+}
 
+// Handlers run on the pool and write their responses as they complete,
+// this thread keeps reading. The connection limits the number of open
+// streams and with it the number of handlers in flight.
+//
+// A shutdown that completes while this thread waits for input is noticed
+// once the client closes the connection, which it does after the final
+// GOAWAY once its streams are complete.
+void serve_pooled(connection_io & io, std::function<response(request &&)> const & fn)
+{
+	try
+	{
+		for (;;)
+		{
+			uint32_t stream_id;
+			request req;
+			while (io.next_request(stream_id, req))
 			{
-				auto & stream = streams[frame.stream_id];
-				next_client_stream = frame.stream_id + 2;
-
-				char * pl = payload;
-				if (frame.flags & frame_flags::padded)
-				{
-					if (frame.payload_size < 1)
-						connection_error(error_code::protocol_error);
+				auto task = std::make_shared<stream_task>(io, stream_id, std::move(req));
 
-					uint8_t pad_length = (uint8_t)*pl++;
-					--frame.payload_size;
+				io.pool->post([&io, &fn, task] {
+					run_handler(io, *task, fn);
 
-					if (frame.payload_size < pad_length)
-						connection_error(error_code::protocol_error);
-
-					frame.payload_size -= pad_length;
-				}
+					try
+					{
+						io.flush();
+					}
+					catch (...)
+					{
+						std::lock_guard<std::mutex> l(io.mutex);
+						if (!io.error)
+							io.error = std::current_exception();
+					}
 
-				if (frame.flags & frame_flags::priority)
-				{
-					if (frame.payload_size < 6)
-						connection_error(error_code::protocol_error);
+					io.handler_done();
+				});
+			}
 
-					pl += 6;
-					frame.payload_size -= 6;
-				}
+			io.flush();
+			if (io.finished() || !io.fill())
+				break;
+		}
+	}
+	catch (...)
+	{
+		std::lock_guard<std::mutex> l(io.mutex);
+		if (!io.error)
+			io.error = std::current_exception();
+	}
 
-				if (frame.flags & frame_flags::end_stream)
-					stream.open_from_client = false;
+	// The handlers refer to the connection, they must finish first.
+	{
+		std::unique_lock<std::mutex> l(io.mutex);
+		io.input_closed = true;
+		io.input_ready.notify_all();
+		while (io.active_handlers != 0)
+			io.handlers_done.wait(l);
+	}
 
-				char * payload_end = pl + frame.payload_size;
-				uint32_t stream_id = frame.stream_id;
-				while ((frame.flags & frame_flags::end_headers) == 0)
-				{
-					size_t next_chunk = std::end(payload) - payload_end;
-					if (next_chunk > client_settings.max_frame_size)
-						next_chunk = client_settings.max_frame_size;
-					frame = read_frame(payload_end, next_chunk);
-					if (frame.type != frame_type::continuation || frame.stream_id != stream_id)
-						connection_error(error_code::protocol_error);
-					payload_end += frame.payload_size;
-				}
+	if (io.error)
+		std::rethrow_exception(io.error);
+}
 
-				std::vector<header> headers;
-				header_dec.decode(headers, { pl, payload_end });
-			}
-			break;
-		case frame_type::continuation:
-			{
-				auto it = streams.find(frame.stream_id);
-				if (it == streams.end())
-					connection_error(error_code::protocol_error);
-				auto && stream = it->second;
-				stream.header_block.append(payload, frame.payload_size);
-
-				if (frame.flags & frame_flags::end_headers)
-					stream.process_headers();
-			}
-			break;
-		case frame_type::ping:
-			if (frame.stream_id != 0)
-				connection_error(error_code::protocol_error);
-			if (frame.payload_size != 8)
-				connection_error(error_code::frame_size_error);
-
-			if (frame.flags & frame_flags::ack)
-			{
-			}
-			else
-			{
-				std::lock_guard<std::mutex> l(send_mutex);
-				pings.push_back({ payload, frame.payload_size });
-				send_ready.notify_one();
-			}
-			break;
-		case frame_type::settings:
-			if (frame.stream_id != 0)
-				connection_error(error_code::protocol_error);
+}
 
-			if (frame.flags & frame_flags::ack)
-			{
-				if (frame.payload_size != 0)
-					connection_error(error_code::frame_size_error);
-				if (--client_settings_in_flight < 0)
-					connection_error(error_code::protocol_error);
-			}
-			else
-			{
-				endpoint_settings new_server_settings = next_server_settings;
+void http2_server(istream & in, ostream & out, std::function<response(request &&)> const & fn, http2_options const & opts)
+{
+	http2_server(in, out, fn, opts, {});
+}
 
-				size_t idx = 0;
-				for (; idx < frame.payload_size; idx += 6)
-				{
-					auto id = static_cast<settings_ids>(load_be<uint16_t>(payload + idx));
-					uint32_t value = load_be<uint32_t>(payload + idx + 2);
+void http2_server(istream & in, ostream & out, std::function<response(request &&)> const & fn, http2_options const & opts,
+	std::string_view prebuf, http_connection_info const * info,
+	request const * upgrade_req, std::string_view upgrade_settings)
+{
+	http2_connection conn(opts);
+	connection_io io(in, out, conn, opts.pool, info);
+
+	// A stop request starts a graceful shutdown, the function returns once
+	// the client's requests are answered. The GOAWAY is written right away
+	// unless a write is under way, it then goes out with that write. The stop
+	// doesn't wait for a client that has stopped reading, unless its socket
+	// buffer happens to be full while nothing else is being written.
+	http_stop_callback on_stop(opts.stop, [&io] {
+		std::unique_lock<std::mutex> l(io.mutex);
+		io.conn.shutdown();
 
-					switch (id)
-					{
-					case settings_ids::header_table_size:
-						new_server_settings.header_table_size = value;
-						break;
-					case settings_ids::enable_push:
-						if (value != 0 && value != 1)
-							connection_error(error_code::protocol_error);
-						new_server_settings.enable_push = value != 0;
-						break;
-					case settings_ids::max_concurrent_streams:
-						new_server_settings.max_concurrent_streams = value;
-						break;
-					case settings_ids::initial_window_size:
-						if (value > 0x7fffffff)
-							connection_error(error_code::flow_control_error);
-						new_server_settings.initial_window_size = value;
-						break;
-					case settings_ids::max_frame_size:
-						if (value < 16384 || value >= (1 << 24))
-							connection_error(error_code::protocol_error);
-						new_server_settings.max_frame_size = value;
-						break;
-					case settings_ids::max_header_list_size:
-						new_server_settings.max_header_list_size = value;
-						break;
-					}
-				}
+		try
+		{
+			io.try_flush(l);
+		}
+		catch (...)
+		{
+		}
+	});
 
-				if (idx != frame.payload_size)
-					connection_error(error_code::frame_size_error);
+	try
+	{
+		{
+			std::lock_guard<std::mutex> l(io.mutex);
+			if (upgrade_req)
+				conn.upgrade(upgrade_settings, *upgrade_req);
+			conn.feed(prebuf.data(), prebuf.size());
+		}
 
-				std::lock_guard<std::mutex> l(send_mutex);
-				next_server_settings = new_server_settings;
-				++setting_acks;
-				send_ready.notify_one();
-			}
-			break;
+		if (io.pool)
+			serve_pooled(io, fn);
+		else
+			serve_inline(io, fn);
+	}
+	catch (http2_connection_error const &)
+	{
+		// The GOAWAY tells the client why the connection is closed.
+		try
+		{
+			io.flush();
 		}
+		catch (...)
+		{
+		}
+
+		throw;
 	}
 }
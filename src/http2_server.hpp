@@ -0,0 +1,15 @@
+#ifndef HTTP2_SERVER_HPP
+#define HTTP2_SERVER_HPP
+
+#include "http_server.hpp"
+
+// Serves an HTTP/2 connection handed over by another server, `prebuf` holds
+// the bytes already read from `in`. Requests refer to `info` if it is not
+// null. A connection upgraded with
+// `Upgrade: h2c` also passes the request that carried the upgrade along with
+// its decoded HTTP2-Settings; the request is served as stream 1.
+void http2_server(istream & in, ostream & out, std::function<response(request &&)> const & fn, http2_options const & opts,
+	std::string_view prebuf, http_connection_info const * info = nullptr,
+	request const * upgrade_req = nullptr, std::string_view upgrade_settings = {});
+
+#endif // HTTP2_SERVER_HPP
@@ -0,0 +1,137 @@
+#include "http2_stream.hpp"
+
+static size_t const initial_index_size = 16;
+
+void http2_stream::close_remote()
+{
+	if (state == http2_stream_state::open)
+		state = http2_stream_state::half_closed_remote;
+	else if (state == http2_stream_state::half_closed_local)
+		state = http2_stream_state::closed;
+}
+
+void http2_stream::close_local()
+{
+	if (state == http2_stream_state::open)
+		state = http2_stream_state::half_closed_local;
+	else if (state == http2_stream_state::half_closed_remote)
+		state = http2_stream_state::closed;
+}
+
+void http2_stream::reset_pending()
+{
+	pending.reset();
+	pending_slices = nullptr;
+	pending_slice_count = 0;
+	chunk.reset();
+	pending_data = {};
+}
+
+http2_stream_table::http2_stream_table()
+	: index_(initial_index_size), size_(0)
+{
+}
+
+// Stream identifiers are handed out sequentially and all of the same
+// parity, so dropping the low bit spreads consecutive streams over
+// consecutive buckets.
+size_t http2_stream_table::probe(uint32_t id) const
+{
+	size_t mask = index_.size() - 1;
+	size_t pos = (id >> 1) & mask;
+	while (index_[pos].id != 0 && index_[pos].id != id)
+		pos = (pos + 1) & mask;
+	return pos;
+}
+
+http2_stream * http2_stream_table::find(uint32_t id)
+{
+	index_entry const & e = index_[this->probe(id)];
+	if (e.id == 0)
+		return nullptr;
+	return &slots_[e.slot];
+}
+
+http2_stream & http2_stream_table::insert(uint32_t id)
+{
+	if ((size_ + 1) * 2 > index_.size())
+		this->grow_index();
+
+	size_t pos = this->probe(id);
+	if (index_[pos].id != 0)
+		return slots_[index_[pos].slot];
+
+	uint32_t slot;
+	if (!free_slots_.empty())
+	{
+		slot = free_slots_.back();
+		free_slots_.pop_back();
+	}
+	else
+	{
+		slot = (uint32_t)slots_.size();
+		slots_.emplace_back();
+		arenas_.emplace_back();
+		slot_ids_.push_back(0);
+	}
+
+	http2_stream & stream = slots_[slot];
+	stream.arena = &arenas_[slot];
+	stream.headers = header_list(stream.arena);
+
+	index_[pos].id = id;
+	index_[pos].slot = slot;
+	slot_ids_[slot] = id;
+	++size_;
+	return stream;
+}
+
+void http2_stream_table::reclaim(uint32_t id)
+{
+	size_t pos = this->probe(id);
+	if (index_[pos].id == 0)
+		return;
+
+	uint32_t slot = index_[pos].slot;
+	if (slots_[slot].state != http2_stream_state::closed)
+		return;
+
+	slots_[slot] = http2_stream();
+	arenas_[slot].reset();
+	slot_ids_[slot] = 0;
+	free_slots_.push_back(slot);
+	this->erase_index(pos);
+	--size_;
+}
+
+void http2_stream_table::grow_index()
+{
+	std::vector<index_entry> old(index_.size() * 2);
+	old.swap(index_);
+
+	for (auto const & e : old)
+	{
+		if (e.id != 0)
+			index_[this->probe(e.id)] = e;
+	}
+}
+
+// Removes the entry at `pos` and shifts the following entries of the probe
+// sequence back, so that lookups never need tombstones.
+void http2_stream_table::erase_index(size_t pos)
+{
+	size_t mask = index_.size() - 1;
+	size_t next = (pos + 1) & mask;
+	while (index_[next].id != 0)
+	{
+		size_t home = (index_[next].id >> 1) & mask;
+		if (((next - home) & mask) >= ((next - pos) & mask))
+		{
+			index_[pos] = index_[next];
+			pos = next;
+		}
+		next = (next + 1) & mask;
+	}
+
+	index_[pos].id = 0;
+}
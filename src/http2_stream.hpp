@@ -0,0 +1,140 @@
+#ifndef HTTP2_STREAM_HPP
+#define HTTP2_STREAM_HPP
+
+#include "http_server.hpp"
+#include "http2_scheduler.hpp"
+#include <deque>
+#include <memory>
+#include <vector>
+
+enum class http2_stream_state
+{
+	idle,
+	open,
+	half_closed_local,
+	half_closed_remote,
+	closed,
+};
+
+struct http2_stream
+{
+	http2_stream_state state = http2_stream_state::idle;
+
+	// Set once the stream is reset by either side, further frames
+	// for it are ignored.
+	bool reset = false;
+
+	// Set while the request is being handled.
+	bool handler_active = false;
+
+	// Memory for the request, its headers included, released once the
+	// stream is reclaimed. Owned by the stream table.
+	http_arena * arena = nullptr;
+	header_list headers;
+
+	// The request refers to `headers`, it is handed out once the header
+	// block is complete.
+	request req;
+
+	http2_priority priority;
+	bool scheduled = false;
+
+	// Flow control windows, the send window may become negative after
+	// the peer reduces SETTINGS_INITIAL_WINDOW_SIZE.
+	int64_t send_window = 0;
+	int64_t recv_window = 0;
+	uint32_t recv_unacked = 0;
+
+	// Request body data that the handler is yet to read. Its window is
+	// released as it is read, so the buffer never holds more than the
+	// stream window. Once the response is sent, the rest of the body is
+	// discarded as it arrives.
+	std::string received;
+	size_t received_offset = 0;
+	bool discard_received = false;
+
+	// The response whose body is waiting for window space. The body is
+	// sent from `pending_slices` if it is in memory, otherwise it is read
+	// into `chunk`. `pending_data` is the part that is yet to be queued.
+	std::shared_ptr<response> pending;
+	std::string_view const * pending_slices = nullptr;
+	size_t pending_slice_count = 0;
+	std::shared_ptr<std::string> chunk;
+	std::string_view pending_data;
+	uint64_t pending_remaining = 0;
+	bool pending_eof = false;
+
+	void reset_pending();
+
+	bool remote_open() const
+	{
+		return state == http2_stream_state::open || state == http2_stream_state::half_closed_local;
+	}
+
+	bool local_open() const
+	{
+		return state == http2_stream_state::open || state == http2_stream_state::half_closed_remote;
+	}
+
+	// Transitions after END_STREAM was received or sent, respectively.
+	void close_remote();
+	void close_local();
+};
+
+// Maps stream identifiers to live streams.
+//
+// Streams are kept in slots that are reused as streams close, the
+// identifiers are looked up in an open-addressed index. Memory is bounded
+// by the peak number of concurrently live streams rather than by the number
+// of streams the connection has seen.
+//
+// Streams never move, pointers to them remain valid until they are
+// reclaimed. Every slot keeps its arena, reset as the slot is reused, so
+// that requests are served from memory allocated for earlier ones.
+struct http2_stream_table
+{
+	http2_stream_table();
+
+	http2_stream * find(uint32_t id);
+	http2_stream & insert(uint32_t id);
+
+	// Releases the stream if it is closed.
+	void reclaim(uint32_t id);
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+	// Calls `f(id, stream)` for every live stream. Streams may be reclaimed
+	// from within `f`, but not inserted.
+	template <typename F>
+	void for_each(F && f)
+	{
+		for (size_t i = 0; i != slots_.size(); ++i)
+		{
+			if (slot_ids_[i] != 0)
+				f(slot_ids_[i], slots_[i]);
+		}
+	}
+
+private:
+	struct index_entry
+	{
+		uint32_t id;
+		uint32_t slot;
+	};
+
+	size_t probe(uint32_t id) const;
+	void grow_index();
+	void erase_index(size_t pos);
+
+	std::vector<index_entry> index_;
+	std::deque<http2_stream> slots_;
+	std::deque<http_arena> arenas_;
+	std::vector<uint32_t> slot_ids_;
+	std::vector<uint32_t> free_slots_;
+	size_t size_;
+};
+
+#endif // HTTP2_STREAM_HPP
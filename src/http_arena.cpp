@@ -0,0 +1,112 @@
+#include "http_arena.hpp"
+#include <cstdint>
+
+static size_t const default_arena_size = 4096;
+
+static char * align_up(char * p, size_t align)
+{
+	uintptr_t v = reinterpret_cast<uintptr_t>(p);
+	return reinterpret_cast<char *>((v + align - 1) & ~uintptr_t(align - 1));
+}
+
+http_arena::http_arena()
+	: cur_(nullptr), end_(nullptr), primary_(nullptr), primary_size_(0), primary_owned_(false),
+	overflow_(nullptr), finalizers_(nullptr), used_(0)
+{
+}
+
+http_arena::http_arena(void * buf, size_t size)
+	: cur_(static_cast<char *>(buf)), end_(static_cast<char *>(buf) + size),
+	primary_(static_cast<char *>(buf)), primary_size_(size), primary_owned_(false),
+	overflow_(nullptr), finalizers_(nullptr), used_(0)
+{
+}
+
+http_arena::~http_arena()
+{
+	this->run_finalizers();
+	this->release_overflow();
+	if (primary_owned_)
+		::operator delete(primary_);
+}
+
+void * http_arena::allocate(size_t size, size_t align)
+{
+	char * p = align_up(cur_, align);
+	if (cur_ == nullptr || p > end_ || size_t(end_ - p) < size)
+	{
+		size_t block_size = default_arena_size;
+		if (overflow_ && overflow_->size * 2 > block_size)
+			block_size = overflow_->size * 2;
+		if (block_size < size + align)
+			block_size = size + align;
+
+		block * b = static_cast<block *>(::operator new(sizeof(block) + block_size));
+		b->next = overflow_;
+		b->size = block_size;
+		overflow_ = b;
+
+		used_ += end_ - cur_;
+		cur_ = reinterpret_cast<char *>(b + 1);
+		end_ = cur_ + block_size;
+		p = align_up(cur_, align);
+	}
+
+	used_ += (p - cur_) + size;
+	cur_ = p + size;
+	return p;
+}
+
+void http_arena::add_finalizer(void * obj, void (*fn)(void *))
+{
+	finalizer * f = static_cast<finalizer *>(this->allocate(sizeof(finalizer), alignof(finalizer)));
+	f->next = finalizers_;
+	f->obj = obj;
+	f->fn = fn;
+	finalizers_ = f;
+}
+
+void http_arena::release_overflow()
+{
+	while (overflow_)
+	{
+		block * next = overflow_->next;
+		::operator delete(overflow_);
+		overflow_ = next;
+	}
+}
+
+void http_arena::run_finalizers()
+{
+	while (finalizers_)
+	{
+		finalizer * f = finalizers_;
+		finalizers_ = f->next;
+		f->fn(f->obj);
+	}
+}
+
+void http_arena::reset()
+{
+	this->run_finalizers();
+
+	if (overflow_)
+	{
+		this->release_overflow();
+
+		size_t needed = used_ + used_ / 2;
+		if (needed > primary_size_)
+		{
+			if (primary_owned_)
+				::operator delete(primary_);
+
+			primary_ = static_cast<char *>(::operator new(needed));
+			primary_size_ = needed;
+			primary_owned_ = true;
+		}
+	}
+
+	cur_ = primary_;
+	end_ = primary_ + primary_size_;
+	used_ = 0;
+}
@@ -0,0 +1,401 @@
+#include "http_coro.hpp"
+#include "http1.hpp"
+#include <optional>
+
+size_t const async_io::would_block;
+
+namespace {
+
+struct detached_task
+{
+	struct promise_type
+	{
+		detached_task get_return_object() noexcept
+		{
+			return {};
+		}
+
+		std::suspend_never initial_suspend() noexcept
+		{
+			return {};
+		}
+
+		std::suspend_never final_suspend() noexcept
+		{
+			return {};
+		}
+
+		void return_void() noexcept
+		{
+		}
+
+		void unhandled_exception() noexcept
+		{
+		}
+	};
+};
+
+detached_task run_detached(task<void> t)
+{
+	co_await std::move(t);
+}
+
+struct readable_awaiter
+{
+	async_io & io;
+
+	bool await_ready() noexcept
+	{
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> h)
+	{
+		io.wait_readable(h);
+	}
+
+	void await_resume() noexcept
+	{
+	}
+};
+
+struct writable_awaiter
+{
+	async_io & io;
+
+	bool await_ready() noexcept
+	{
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> h)
+	{
+		io.wait_writable(h);
+	}
+
+	void await_resume() noexcept
+	{
+	}
+};
+
+struct async_fixed_req_stream final
+	: async_istream
+{
+	async_fixed_req_stream(std::string_view & prebuf, async_io & io, uint64_t limit)
+		: prebuf_(prebuf), io_(io), limit_(limit)
+	{
+	}
+
+	task<size_t> read(char * buf, size_t len) override
+	{
+		if (len > limit_)
+			len = (size_t)limit_;
+		if (len == 0)
+			co_return 0;
+
+		if (!prebuf_.empty())
+		{
+			len = (std::min)(len, prebuf_.size());
+			memcpy(buf, prebuf_.data(), len);
+			prebuf_ = prebuf_.substr(len);
+
+			limit_ -= len;
+			co_return len;
+		}
+
+		size_t r = co_await io_.read(buf, len);
+		assert(r <= len);
+		limit_ -= r;
+		co_return r;
+	}
+
+private:
+	std::string_view & prebuf_;
+	async_io & io_;
+	uint64_t limit_;
+};
+
+// Decodes a chunked body. More input is read into the free part of the
+// header buffer, the bytes that follow the body are left in `prebuf` for
+// the next request.
+struct async_chunked_req_stream final
+	: async_istream
+{
+	async_chunked_req_stream(std::string_view & prebuf, async_io & io, char * buf, char const * buf_end)
+		: prebuf_(prebuf), io_(io), buf_(buf), buf_end_(buf_end)
+	{
+	}
+
+	task<size_t> read(char * buf, size_t len) override
+	{
+		while (len != 0 && !decoder_.done())
+		{
+			if (prebuf_.empty())
+			{
+				if (buf_ == buf_end_)
+					throw std::length_error("no room for the request body");
+
+				size_t r = co_await io_.read(buf_, buf_end_ - buf_);
+				if (r == 0)
+					throw std::runtime_error("unexpected end of stream");
+				prebuf_ = std::string_view(buf_, r);
+			}
+
+			size_t r = len;
+			if (!decoder_.decode(prebuf_, buf, r))
+				throw std::runtime_error("invalid chunked encoding");
+			if (r != 0)
+				co_return r;
+		}
+
+		co_return 0;
+	}
+
+private:
+	std::string_view & prebuf_;
+	async_io & io_;
+	char * buf_;
+	char const * buf_end_;
+	chunked_decoder decoder_;
+};
+
+struct connection_buffers
+{
+	char header_buf[64 * 1024];
+	char write_buf[16 * 1024];
+	std::string head;
+};
+
+task<void> send_response(async_io & io, response resp, connection_buffers & bufs)
+{
+	char * write_buf = bufs.write_buf;
+	size_t const write_buf_size = sizeof bufs.write_buf;
+
+	std::string & head = bufs.head;
+	head.clear();
+	format_response_head(head, resp);
+
+	size_t slice_count;
+	std::string_view const * slices = resp.body.slices(slice_count);
+	if (slices && resp.content_length == resp.body.size())
+	{
+		std::string_view iov[64];
+		response_gather gather(head, slices, slice_count);
+		while (size_t iov_len = gather.next(iov, sizeof iov / sizeof iov[0]))
+			co_await io.write_all_vec(iov, iov_len);
+
+		co_return;
+	}
+
+	co_await io.write_all(head.data(), head.size());
+
+	if (resp.content_length != http_body::unknown_size)
+	{
+		while (resp.content_length)
+		{
+			size_t chunk = write_buf_size;
+			if (chunk > resp.content_length)
+				chunk = (size_t)resp.content_length;
+
+			chunk = resp.body->read(write_buf, chunk);
+			co_await io.write_all(write_buf, chunk);
+
+			resp.content_length -= chunk;
+		}
+	}
+	else
+	{
+		for (;;)
+		{
+			size_t chunk = resp.body->read(write_buf, write_buf_size);
+			if (chunk == 0)
+			{
+				co_await io.write_all("0\r\n\r\n", 5);
+				break;
+			}
+
+			char chunk_header[20];
+			size_t chunk_header_len = format_chunk_header(chunk_header, chunk);
+			co_await io.write_all(chunk_header, chunk_header_len);
+
+			co_await io.write_all(write_buf, chunk);
+			co_await io.write_all("\r\n", 2);
+		}
+	}
+}
+
+}
+
+void spawn(task<void> t)
+{
+	run_detached(std::move(t));
+}
+
+size_t async_io::try_write_vec(std::string_view const * bufs, size_t count)
+{
+	for (size_t i = 0; i != count; ++i)
+	{
+		if (!bufs[i].empty())
+			return this->try_write(bufs[i].data(), bufs[i].size());
+	}
+
+	return 0;
+}
+
+task<size_t> async_io::read(char * buf, size_t len)
+{
+	for (;;)
+	{
+		size_t r = this->try_read(buf, len);
+		if (r != would_block)
+			co_return r;
+
+		co_await readable_awaiter{ *this };
+	}
+}
+
+task<void> async_io::write_all(char const * buf, size_t len)
+{
+	while (len)
+	{
+		size_t r = this->try_write(buf, len);
+		if (r == would_block)
+		{
+			co_await writable_awaiter{ *this };
+			continue;
+		}
+
+		assert(r <= len);
+		buf += r;
+		len -= r;
+	}
+}
+
+task<void> async_io::write_all_vec(std::string_view * bufs, size_t count)
+{
+	while (count && bufs->empty())
+	{
+		++bufs;
+		--count;
+	}
+
+	while (count)
+	{
+		size_t r = this->try_write_vec(bufs, count);
+		if (r == would_block)
+		{
+			co_await writable_awaiter{ *this };
+			continue;
+		}
+
+		while (count && r >= bufs->size())
+		{
+			r -= bufs->size();
+			++bufs;
+			--count;
+		}
+
+		if (count)
+			bufs->remove_prefix(r);
+	}
+}
+
+task<void> co_http_server(async_io & io, std::function<task<response>(co_request &&)> fn)
+{
+	connection_buffers bufs;
+	char * const header_buf = bufs.header_buf;
+	char * last = header_buf;
+	char const * const end = header_buf + sizeof bufs.header_buf;
+
+	char arena_buf[8 * 1024];
+	http_arena arena(arena_buf, sizeof arena_buf);
+
+	for (;;)
+	{
+		arena.reset();
+
+		size_t scanned = 0;
+		size_t head_len;
+		while ((head_len = find_request_head({ header_buf, size_t(last - header_buf) }, scanned)) == 0)
+		{
+			if (last == end)
+			{
+				co_await send_response(io, 413, bufs);
+				co_return;
+			}
+
+			size_t r = co_await io.read(last, end - last);
+			assert(r <= size_t(end - last));
+			if (r == 0)
+			{
+				if (last != header_buf)
+					co_await send_response(io, 400, bufs);
+				co_return;
+			}
+
+			last += r;
+		}
+
+		request parsed;
+		parsed.headers = header_list(&arena);
+		parsed.headers.reserve(32);
+
+		if (!parse_request_head(parsed, { header_buf, head_len }))
+		{
+			co_await send_response(io, 400, bufs);
+			co_return;
+		}
+
+		std::string_view prebuf(header_buf + head_len, last - header_buf - head_len);
+
+		async_istream * body = nullptr;
+
+		uint64_t content_length = 0;
+		switch (get_body_kind(parsed, content_length))
+		{
+		case body_kind::none:
+			body = arena.make<async_fixed_req_stream>(prebuf, io, 0);
+			break;
+		case body_kind::fixed:
+			body = arena.make<async_fixed_req_stream>(prebuf, io, content_length);
+			break;
+		case body_kind::chunked:
+			body = arena.make<async_chunked_req_stream>(prebuf, io, header_buf + head_len, end);
+			break;
+		case body_kind::invalid:
+			co_await send_response(io, 400, bufs);
+			co_return;
+		}
+
+		co_request req;
+		req.method = parsed.method;
+		req.path = parsed.path;
+		req.headers = std::move(parsed.headers);
+		req.body = body;
+		req.arena = &arena;
+
+		std::optional<response> resp;
+		try
+		{
+			resp.emplace(co_await fn(std::move(req)));
+		}
+		catch (std::exception const & e)
+		{
+			resp.emplace(e.what(), std::initializer_list<header>{ { "content-type", "text/plain" } }, 500);
+		}
+		catch (...)
+		{
+			resp.emplace(500);
+		}
+
+		co_await send_response(io, std::move(*resp), bufs);
+
+		while (co_await body->read(bufs.write_buf, sizeof bufs.write_buf) != 0)
+		{
+		}
+
+		if (!prebuf.empty())
+			memmove(header_buf, prebuf.data(), prebuf.size());
+		last = header_buf + prebuf.size();
+	}
+}
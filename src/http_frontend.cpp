@@ -0,0 +1,137 @@
+#include "http_frontend.hpp"
+#include "http1.hpp"
+#include "http2_frame.hpp"
+#include "http2_server.hpp"
+#include "http_proxy.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+enum class protocol
+{
+	unknown,
+	http1,
+	http2,
+	proxy_v1,
+	proxy_v2,
+	tls,
+};
+
+char const proxy_v1_signature[] = "PROXY ";
+char const proxy_v2_signature[] = "\r\n\r\n\0\r\nQUIT\n";
+
+// Returns true if `buf` starts with `sig`. Sets `more` if `buf` is too
+// short to tell.
+bool starts_with(std::string_view buf, std::string_view sig, bool & more)
+{
+	size_t len = (std::min)(buf.size(), sig.size());
+	if (memcmp(buf.data(), sig.data(), len) != 0)
+		return false;
+
+	if (len < sig.size())
+	{
+		more = true;
+		return false;
+	}
+
+	return true;
+}
+
+// Tells the protocol from the first bytes of a connection, returns
+// `unknown` until there are enough of them.
+protocol sniff(std::string_view buf, bool accept_proxy)
+{
+	if (buf.empty())
+		return protocol::unknown;
+
+	// A TLS handshake record of version 3.x.
+	if (buf[0] == 0x16)
+	{
+		if (buf.size() < 2)
+			return protocol::unknown;
+		return buf[1] == 3? protocol::tls: protocol::http1;
+	}
+
+	bool more = false;
+	if (starts_with(buf, { http2_client_preface, http2_client_preface_size }, more))
+		return protocol::http2;
+
+	if (accept_proxy)
+	{
+		if (starts_with(buf, { proxy_v1_signature, sizeof proxy_v1_signature - 1 }, more))
+			return protocol::proxy_v1;
+		if (starts_with(buf, { proxy_v2_signature, sizeof proxy_v2_signature - 1 }, more))
+			return protocol::proxy_v2;
+	}
+
+	return more? protocol::unknown: protocol::http1;
+}
+
+bool read_more(istream & in, std::string & buf)
+{
+	size_t const chunk = 4096;
+
+	size_t old_size = buf.size();
+	buf.resize(old_size + chunk);
+	size_t r = in.read(&buf[old_size], chunk);
+	buf.resize(old_size + r);
+	return r != 0;
+}
+
+}
+
+void http_frontend(istream & in, ostream & out, std::function<response(request &&)> const & fn, http_frontend_options const & opts)
+{
+	std::string buf;
+	size_t pos = 0;
+	bool accept_proxy = opts.accept_proxy;
+
+	// The requests refer to the connection's information.
+	http_connection_info info;
+	http_connection_info const * info_ptr = nullptr;
+
+	protocol p;
+	for (;;)
+	{
+		std::string_view rest = std::string_view(buf).substr(pos);
+
+		p = sniff(rest, accept_proxy);
+		if (p == protocol::proxy_v1 || p == protocol::proxy_v2)
+		{
+			// Only a single header is accepted, the protocol of the
+			// connection follows.
+			size_t size = parse_proxy_header(rest, info);
+			if (size == std::string_view::npos)
+				return;
+
+			if (size != 0)
+			{
+				pos += size;
+				accept_proxy = false;
+				info_ptr = &info;
+				continue;
+			}
+		}
+		else if (p != protocol::unknown)
+		{
+			break;
+		}
+
+		if (!read_more(in, buf))
+			return;
+	}
+
+	std::string_view rest = std::string_view(buf).substr(pos);
+	switch (p)
+	{
+	case protocol::http1:
+		http_server(in, out, fn, opts.h2, rest, info_ptr);
+		break;
+	case protocol::http2:
+		http2_server(in, out, fn, opts.h2, rest, info_ptr);
+		break;
+	default:
+		break;
+	}
+}
@@ -0,0 +1,329 @@
+#include "http_proxy.hpp"
+#include "http2_frame.hpp"
+#include <cstring>
+
+static char const v1_signature[] = "PROXY ";
+static char const v2_signature[] = "\r\n\r\n\0\r\nQUIT\n";
+
+// The text header is a single line of at most 107 bytes.
+static size_t const v1_max_size = 107;
+static size_t const v2_header_size = 16;
+
+enum v2_tlv_type : uint8_t
+{
+	pp2_type_alpn = 0x01,
+	pp2_type_authority = 0x02,
+	pp2_type_unique_id = 0x05,
+	pp2_type_ssl = 0x20,
+	pp2_subtype_ssl_version = 0x21,
+};
+
+static bool is_digit(char ch)
+{
+	return '0' <= ch && ch <= '9';
+}
+
+static int hex_digit(char ch)
+{
+	if ('0' <= ch && ch <= '9')
+		return ch - '0';
+	if ('a' <= ch && ch <= 'f')
+		return ch - 'a' + 10;
+	if ('A' <= ch && ch <= 'F')
+		return ch - 'A' + 10;
+	return -1;
+}
+
+static bool parse_ipv4(uint8_t * out, std::string_view str)
+{
+	for (size_t i = 0; i != 4; ++i)
+	{
+		if (i != 0)
+		{
+			if (str.empty() || str[0] != '.')
+				return false;
+			str.remove_prefix(1);
+		}
+
+		uint32_t value = 0;
+		size_t n = 0;
+		while (n != str.size() && n != 3 && is_digit(str[n]))
+			value = value * 10 + (str[n++] - '0');
+
+		if (n == 0 || value > 255)
+			return false;
+
+		out[i] = uint8_t(value);
+		str.remove_prefix(n);
+	}
+
+	return str.empty();
+}
+
+static bool parse_ipv6(uint8_t * out, std::string_view str)
+{
+	uint16_t groups[8];
+	size_t count = 0;
+
+	// The position of the `::` that stands for a run of zero groups.
+	size_t gap = size_t(-1);
+
+	if (str.size() >= 2 && str[0] == ':' && str[1] == ':')
+	{
+		gap = 0;
+		str.remove_prefix(2);
+	}
+
+	while (!str.empty())
+	{
+		// The last 32 bits may be written as an IPv4 address.
+		if (count <= 6 && str.find(':') == std::string_view::npos && str.find('.') != std::string_view::npos)
+		{
+			uint8_t v4[4];
+			if (!parse_ipv4(v4, str))
+				return false;
+
+			groups[count++] = uint16_t((v4[0] << 8) | v4[1]);
+			groups[count++] = uint16_t((v4[2] << 8) | v4[3]);
+			break;
+		}
+
+		uint32_t value = 0;
+		size_t n = 0;
+		while (n != str.size() && n != 4 && hex_digit(str[n]) >= 0)
+			value = value * 16 + hex_digit(str[n++]);
+
+		if (n == 0 || count == 8)
+			return false;
+
+		groups[count++] = uint16_t(value);
+		str.remove_prefix(n);
+		if (str.empty())
+			break;
+
+		if (str[0] != ':' || str.size() == 1)
+			return false;
+		str.remove_prefix(1);
+
+		if (str[0] == ':')
+		{
+			if (gap != size_t(-1))
+				return false;
+			gap = count;
+			str.remove_prefix(1);
+		}
+	}
+
+	if (gap == size_t(-1)? count != 8: count > 7)
+		return false;
+
+	size_t zeros = 8 - count;
+	size_t j = 0;
+	for (size_t i = 0; i != 8; ++i)
+	{
+		uint16_t value = 0;
+		if (i < gap || i >= gap + zeros)
+			value = groups[j++];
+
+		out[2 * i] = uint8_t(value >> 8);
+		out[2 * i + 1] = uint8_t(value);
+	}
+
+	return true;
+}
+
+static bool parse_port(uint16_t & port, std::string_view str)
+{
+	if (str.empty() || str.size() > 5)
+		return false;
+
+	uint32_t value = 0;
+	for (char ch : str)
+	{
+		if (!is_digit(ch))
+			return false;
+		value = value * 10 + (ch - '0');
+	}
+
+	if (value > 0xffff)
+		return false;
+
+	port = uint16_t(value);
+	return true;
+}
+
+// PROXY TCP4 192.0.2.1 192.0.2.2 56324 443\r\n
+static bool parse_v1(std::string_view line, http_connection_info & info)
+{
+	auto next_token = [&](std::string_view & tok) {
+		size_t pos = line.find(' ');
+		tok = line.substr(0, pos);
+		line = pos == std::string_view::npos? std::string_view(): line.substr(pos + 1);
+		return !tok.empty();
+	};
+
+	std::string_view proto;
+	if (!next_token(proto))
+		return false;
+
+	// The proxy doesn't know the addresses, the rest of the line is
+	// to be ignored.
+	if (proto == "UNKNOWN")
+		return true;
+
+	http_address::kind family;
+	if (proto == "TCP4")
+		family = http_address::kind::ipv4;
+	else if (proto == "TCP6")
+		family = http_address::kind::ipv6;
+	else
+		return false;
+
+	std::string_view src, dst, sport, dport;
+	if (!next_token(src) || !next_token(dst) || !next_token(sport) || !next_token(dport) || !line.empty())
+		return false;
+
+	auto parse_ip = family == http_address::kind::ipv4? parse_ipv4: parse_ipv6;
+	if (!parse_ip(info.source.ip, src) || !parse_ip(info.destination.ip, dst)
+		|| !parse_port(info.source.port, sport) || !parse_port(info.destination.port, dport))
+	{
+		return false;
+	}
+
+	info.source.family = family;
+	info.destination.family = family;
+	return true;
+}
+
+static bool parse_v2_tlvs(char const * p, char const * last, http_connection_info & info)
+{
+	while (p != last)
+	{
+		if (last - p < 3)
+			return false;
+
+		uint8_t type = uint8_t(p[0]);
+		size_t len = load_be<uint16_t>(p + 1);
+		p += 3;
+
+		if (size_t(last - p) < len)
+			return false;
+
+		std::string_view value(p, len);
+		switch (type)
+		{
+		case pp2_type_alpn:
+			info.alpn.assign(value.data(), value.size());
+			break;
+		case pp2_type_authority:
+			info.authority.assign(value.data(), value.size());
+			break;
+		case pp2_type_unique_id:
+			info.unique_id.assign(value.data(), value.size());
+			break;
+		case pp2_type_ssl:
+			// A client bit field and a 32-bit verification result,
+			// followed by sub-fields.
+			if (len < 5)
+				return false;
+
+			info.tls = (value[0] & 0x01) != 0;
+			if (!parse_v2_tlvs(p + 5, p + len, info))
+				return false;
+			break;
+		case pp2_subtype_ssl_version:
+			info.tls_version.assign(value.data(), value.size());
+			break;
+		}
+
+		p += len;
+	}
+
+	return true;
+}
+
+static bool parse_v2(std::string_view buf, http_connection_info & info)
+{
+	char const * p = buf.data();
+	uint8_t version_command = uint8_t(p[12]);
+	uint8_t family = uint8_t(p[13]);
+	char const * last = buf.data() + buf.size();
+	p += v2_header_size;
+
+	// A LOCAL connection was made by the proxy itself, e.g. for a health
+	// check; its addresses are to be ignored.
+	if ((version_command & 0x0f) == 0)
+		return true;
+	if ((version_command & 0x0f) != 1)
+		return false;
+
+	size_t addr_size;
+	switch (family >> 4)
+	{
+	case 0:
+		addr_size = 0;
+		break;
+	case 1:
+		addr_size = 12;
+		if (size_t(last - p) < addr_size)
+			return false;
+
+		info.source.family = http_address::kind::ipv4;
+		info.destination.family = http_address::kind::ipv4;
+		memcpy(info.source.ip, p, 4);
+		memcpy(info.destination.ip, p + 4, 4);
+		info.source.port = load_be<uint16_t>(p + 8);
+		info.destination.port = load_be<uint16_t>(p + 10);
+		break;
+	case 2:
+		addr_size = 36;
+		if (size_t(last - p) < addr_size)
+			return false;
+
+		info.source.family = http_address::kind::ipv6;
+		info.destination.family = http_address::kind::ipv6;
+		memcpy(info.source.ip, p, 16);
+		memcpy(info.destination.ip, p + 16, 16);
+		info.source.port = load_be<uint16_t>(p + 32);
+		info.destination.port = load_be<uint16_t>(p + 34);
+		break;
+	case 3:
+		addr_size = 216;
+		if (size_t(last - p) < addr_size)
+			return false;
+
+		info.source.family = http_address::kind::unix_socket;
+		info.destination.family = http_address::kind::unix_socket;
+		break;
+	default:
+		return false;
+	}
+
+	return parse_v2_tlvs(p + addr_size, last, info);
+}
+
+size_t parse_proxy_header(std::string_view buf, http_connection_info & info)
+{
+	size_t const npos = std::string_view::npos;
+
+	if (buf.substr(0, sizeof v1_signature - 1) == std::string_view(v1_signature, sizeof v1_signature - 1))
+	{
+		size_t pos = buf.substr(0, v1_max_size).find("\r\n");
+		if (pos == npos)
+			return buf.size() < v1_max_size? 0: npos;
+
+		std::string_view line = buf.substr(sizeof v1_signature - 1, pos - (sizeof v1_signature - 1));
+		return parse_v1(line, info)? pos + 2: npos;
+	}
+
+	if (buf.size() < v2_header_size)
+		return 0;
+	if (memcmp(buf.data(), v2_signature, sizeof v2_signature - 1) != 0 || (buf[12] & 0xf0) != 0x20)
+		return npos;
+
+	size_t size = v2_header_size + load_be<uint16_t>(buf.data() + 14);
+	if (buf.size() < size)
+		return 0;
+
+	return parse_v2(buf.substr(0, size), info)? size: npos;
+}
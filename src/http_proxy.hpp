@@ -0,0 +1,11 @@
+#ifndef HTTP_PROXY_HPP
+#define HTTP_PROXY_HPP
+
+#include "http_server.hpp"
+
+// Parses the PROXY protocol header, version 1 or 2, at the start of `buf`.
+// Returns its size, zero if it is not complete yet, or `npos` if it is
+// malformed.
+size_t parse_proxy_header(std::string_view buf, http_connection_info & info);
+
+#endif // HTTP_PROXY_HPP
@@ -0,0 +1,249 @@
+#include "http_router.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+static std::string_view const known_methods[] = {
+	"GET", "HEAD", "POST", "PUT", "DELETE", "CONNECT", "OPTIONS", "TRACE", "PATCH",
+};
+
+static size_t method_index(std::string_view method)
+{
+	for (size_t i = 0; i != sizeof known_methods / sizeof known_methods[0]; ++i)
+	{
+		if (known_methods[i] == method)
+			return i;
+	}
+
+	return size_t(-1);
+}
+
+uint32_t const http_router::npos;
+
+http_router::node::node()
+	: param_child(npos), wildcard_child(npos), terminal(false)
+{
+	std::fill(std::begin(methods), std::end(methods), npos);
+}
+
+http_router::http_router()
+	: nodes_(1)
+{
+}
+
+uint32_t http_router::insert_static(uint32_t idx, std::string_view text)
+{
+	while (!text.empty())
+	{
+		size_t pos = nodes_[idx].child_keys.find(text[0]);
+		if (pos == std::string::npos)
+		{
+			uint32_t child = (uint32_t)nodes_.size();
+			nodes_.emplace_back();
+			nodes_.back().prefix = std::string(text);
+
+			node & n = nodes_[idx];
+			auto it = std::upper_bound(n.child_keys.begin(), n.child_keys.end(), text[0]);
+			pos = it - n.child_keys.begin();
+			n.child_keys.insert(it, text[0]);
+			n.children.insert(n.children.begin() + pos, child);
+			return child;
+		}
+
+		uint32_t child = nodes_[idx].children[pos];
+		std::string const & prefix = nodes_[child].prefix;
+
+		size_t common = 0;
+		while (common != prefix.size() && common != text.size() && prefix[common] == text[common])
+			++common;
+
+		if (common != prefix.size())
+		{
+			uint32_t mid = (uint32_t)nodes_.size();
+			nodes_.emplace_back();
+
+			node & m = nodes_[mid];
+			node & c = nodes_[child];
+			m.prefix = c.prefix.substr(0, common);
+			c.prefix.erase(0, common);
+			m.child_keys.push_back(c.prefix[0]);
+			m.children.push_back(child);
+
+			nodes_[idx].children[pos] = mid;
+			child = mid;
+		}
+
+		idx = child;
+		text.remove_prefix(common);
+	}
+
+	return idx;
+}
+
+uint32_t http_router::insert_param(uint32_t idx, std::string_view name, bool wildcard)
+{
+	uint32_t child = wildcard? nodes_[idx].wildcard_child: nodes_[idx].param_child;
+	if (child != npos)
+	{
+		if (nodes_[child].param_name != name)
+			throw std::invalid_argument("conflicting parameter names in route");
+		return child;
+	}
+
+	child = (uint32_t)nodes_.size();
+	nodes_.emplace_back();
+	nodes_.back().param_name = std::string(name);
+
+	if (wildcard)
+		nodes_[idx].wildcard_child = child;
+	else
+		nodes_[idx].param_child = child;
+	return child;
+}
+
+void http_router::add(std::string_view method, std::string_view pattern, handler h)
+{
+	if (pattern.empty() || pattern[0] != '/')
+		throw std::invalid_argument("route pattern must start with a slash");
+
+	uint32_t idx = 0;
+	size_t param_count = 0;
+	while (!pattern.empty())
+	{
+		size_t special = 0;
+		while (special != pattern.size()
+			&& !((pattern[special] == ':' || pattern[special] == '*') && special != 0 && pattern[special - 1] == '/'))
+		{
+			++special;
+		}
+
+		idx = this->insert_static(idx, pattern.substr(0, special));
+		pattern.remove_prefix(special);
+
+		if (pattern.empty())
+			break;
+
+		bool wildcard = pattern[0] == '*';
+		size_t name_end = pattern.find('/');
+		if (name_end == std::string_view::npos)
+			name_end = pattern.size();
+		else if (wildcard)
+			throw std::invalid_argument("wildcard must be the last segment of a route");
+
+		if (++param_count > route_params::max_params)
+			throw std::invalid_argument("too many parameters in route");
+
+		idx = this->insert_param(idx, pattern.substr(1, name_end - 1), wildcard);
+		pattern.remove_prefix(name_end);
+	}
+
+	uint32_t handler_idx = (uint32_t)handlers_.size();
+	handlers_.push_back(std::move(h));
+
+	node & n = nodes_[idx];
+	n.terminal = true;
+
+	size_t mi = method_index(method);
+	if (mi != size_t(-1))
+		n.methods[mi] = handler_idx;
+	else
+		n.other_methods.emplace_back(std::string(method), handler_idx);
+}
+
+uint32_t http_router::find_method(node const & n, std::string_view method) const
+{
+	size_t mi = method_index(method);
+	if (mi != size_t(-1))
+		return n.methods[mi];
+
+	for (auto const & kv : n.other_methods)
+	{
+		if (kv.first == method)
+			return kv.second;
+	}
+
+	return npos;
+}
+
+uint32_t http_router::match_node(uint32_t idx, std::string_view path, route_params & params) const
+{
+	node const & n = nodes_[idx];
+
+	if (path.empty() && n.terminal)
+		return idx;
+
+	if (!path.empty())
+	{
+		size_t pos = n.child_keys.find(path[0]);
+		if (pos != std::string::npos)
+		{
+			uint32_t child = n.children[pos];
+			std::string const & prefix = nodes_[child].prefix;
+			if (path.size() >= prefix.size() && std::equal(prefix.begin(), prefix.end(), path.data()))
+			{
+				uint32_t r = this->match_node(child, path.substr(prefix.size()), params);
+				if (r != npos)
+					return r;
+			}
+		}
+
+		if (n.param_child != npos)
+		{
+			size_t seg_end = path.find('/');
+			if (seg_end == std::string_view::npos)
+				seg_end = path.size();
+
+			if (seg_end != 0)
+			{
+				params.push(nodes_[n.param_child].param_name, path.substr(0, seg_end));
+				uint32_t r = this->match_node(n.param_child, path.substr(seg_end), params);
+				if (r != npos)
+					return r;
+				params.pop();
+			}
+		}
+	}
+
+	if (n.wildcard_child != npos)
+	{
+		params.push(nodes_[n.wildcard_child].param_name, path);
+		return n.wildcard_child;
+	}
+
+	return npos;
+}
+
+uint32_t http_router::match_path(std::string_view path, route_params & params) const
+{
+	size_t query = path.find('?');
+	if (query != std::string_view::npos)
+		path = path.substr(0, query);
+
+	return this->match_node(0, path, params);
+}
+
+http_router::handler const * http_router::match(std::string_view method, std::string_view path, route_params & params) const
+{
+	uint32_t idx = this->match_path(path, params);
+	if (idx == npos)
+		return nullptr;
+
+	uint32_t h = this->find_method(nodes_[idx], method);
+	if (h == npos)
+		return nullptr;
+
+	return &handlers_[h];
+}
+
+response http_router::operator()(request && req) const
+{
+	route_params params;
+	uint32_t idx = this->match_path(req.path, params);
+	if (idx == npos)
+		return 404;
+
+	uint32_t h = this->find_method(nodes_[idx], req.method);
+	if (h == npos)
+		return 405;
+
+	return handlers_[h](std::move(req), params);
+}
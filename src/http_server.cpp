@@ -1,13 +1,10 @@
 #include "http_server.hpp"
-#include <string_utils.hpp>
+#include "http1.hpp"
+#include "http2_frame.hpp"
+#include "http2_server.hpp"
 #include <algorithm>
 #include <iostream>
-
-static std::pair<uint16_t, std::string_view> const status_texts[] = {
-	{ 200, "OK" },
-	{ 303, "See Other" },
-	{ 404, "Not Found" },
-};
+#include <new>
 
 int compare_header_name(std::string_view lhs, std::string_view rhs) noexcept
 {
@@ -40,7 +37,7 @@ int compare_header_name(std::string_view lhs, std::string_view rhs) noexcept
 std::pair<header_view const *, header_view const *> get_header_range(header_list const & headers, std::string_view name)
 {
 	auto r = std::equal_range(headers.begin(), headers.end(), name);
-	return std::make_pair(&*r.first, &*r.second);
+	return std::make_pair(headers.data() + (r.first - headers.begin()), headers.data() + (r.second - headers.begin()));
 }
 
 std::string_view const * get_single(header_list const & headers, std::string_view name)
@@ -52,6 +49,227 @@ std::string_view const * get_single(header_list const & headers, std::string_vie
 	return &r.first->value;
 }
 
+http_body::http_body() noexcept
+	: kind_(kind::empty), stream_(nullptr)
+{
+}
+
+http_body::http_body(std::nullptr_t) noexcept
+	: http_body()
+{
+}
+
+http_body::http_body(istream & stream) noexcept
+	: kind_(kind::borrowed), stream_(&stream)
+{
+}
+
+http_body::http_body(std::shared_ptr<istream> stream) noexcept
+	: kind_(kind::empty), stream_(stream.get())
+{
+	if (stream_ != nullptr)
+	{
+		kind_ = kind::shared;
+		new(&shared_) std::shared_ptr<istream>(std::move(stream));
+	}
+}
+
+http_body::http_body(std::string_view str)
+{
+	if (str.size() <= inline_capacity)
+		this->set_inline(str.data(), str.size());
+	else
+		this->set_owned(std::string(str.data(), str.size()), 0, str.size());
+}
+
+http_body::http_body(std::string && str)
+{
+	if (str.size() <= inline_capacity)
+	{
+		this->set_inline(str.data(), str.size());
+	}
+	else
+	{
+		size_t size = str.size();
+		this->set_owned(std::move(str), 0, size);
+	}
+}
+
+http_body::http_body(std::vector<std::string_view> slices, std::shared_ptr<void> owner)
+{
+	this->set_rope(std::move(slices), 0, std::move(owner));
+}
+
+void http_body::set_inline(char const * data, size_t size) noexcept
+{
+	kind_ = kind::inline_string;
+	new(&inline_) inline_body();
+	if (size)
+		memcpy(inline_.data, data, size);
+
+	inline_.single = std::string_view(inline_.data, size);
+	inline_.mem.cur = &inline_.single;
+	inline_.mem.last = &inline_.single + 1;
+	stream_ = &inline_.mem;
+}
+
+void http_body::set_owned(std::string && str, size_t offset, size_t size) noexcept
+{
+	kind_ = kind::owned_string;
+	new(&owned_) owned_body();
+	owned_.str = std::move(str);
+
+	owned_.single = std::string_view(owned_.str.data() + offset, size);
+	owned_.mem.cur = &owned_.single;
+	owned_.mem.last = &owned_.single + 1;
+	stream_ = &owned_.mem;
+}
+
+void http_body::set_rope(std::vector<std::string_view> && slices, size_t first, std::shared_ptr<void> && owner) noexcept
+{
+	kind_ = kind::rope;
+	new(&rope_) rope_body();
+	rope_.slices = std::move(slices);
+	rope_.owner = std::move(owner);
+
+	rope_.mem.cur = rope_.slices.data() + first;
+	rope_.mem.last = rope_.slices.data() + rope_.slices.size();
+	stream_ = &rope_.mem;
+}
+
+http_body::http_body(http_body && o) noexcept
+{
+	this->move_from(std::move(o));
+}
+
+http_body & http_body::operator=(http_body && o) noexcept
+{
+	if (this != &o)
+	{
+		this->destroy();
+		this->move_from(std::move(o));
+	}
+
+	return *this;
+}
+
+http_body::~http_body()
+{
+	this->destroy();
+}
+
+constexpr uint64_t http_body::unknown_size;
+
+uint64_t http_body::size() const noexcept
+{
+	size_t count;
+	std::string_view const * bufs = this->slices(count);
+	if (!bufs)
+		return unknown_size;
+
+	uint64_t r = 0;
+	for (size_t i = 0; i != count; ++i)
+		r += bufs[i].size();
+	return r;
+}
+
+std::string_view const * http_body::slices(size_t & count) const noexcept
+{
+	memory_istream const * mem;
+	switch (kind_)
+	{
+	case kind::inline_string:
+		mem = &inline_.mem;
+		break;
+	case kind::owned_string:
+		mem = &owned_.mem;
+		break;
+	case kind::rope:
+		mem = &rope_.mem;
+		break;
+	default:
+		count = 0;
+		return nullptr;
+	}
+
+	count = mem->last - mem->cur;
+	return mem->cur;
+}
+
+void http_body::move_from(http_body && o) noexcept
+{
+	kind_ = o.kind_;
+	stream_ = o.stream_;
+
+	switch (kind_)
+	{
+	case kind::empty:
+	case kind::borrowed:
+		break;
+	case kind::shared:
+		new(&shared_) std::shared_ptr<istream>(std::move(o.shared_));
+		break;
+	case kind::inline_string:
+		this->set_inline(o.inline_.single.data(), o.inline_.single.size());
+		break;
+	case kind::owned_string:
+		{
+			size_t offset = o.owned_.single.data() - o.owned_.str.data();
+			this->set_owned(std::move(o.owned_.str), offset, o.owned_.single.size());
+		}
+		break;
+	case kind::rope:
+		this->set_rope(std::move(o.rope_.slices), o.rope_.mem.cur - o.rope_.slices.data(), std::move(o.rope_.owner));
+		break;
+	}
+
+	o.destroy();
+}
+
+void http_body::destroy() noexcept
+{
+	switch (kind_)
+	{
+	case kind::empty:
+	case kind::borrowed:
+		break;
+	case kind::shared:
+		shared_.~shared_ptr();
+		break;
+	case kind::inline_string:
+		inline_.~inline_body();
+		break;
+	case kind::owned_string:
+		owned_.~owned_body();
+		break;
+	case kind::rope:
+		rope_.~rope_body();
+		break;
+	}
+
+	kind_ = kind::empty;
+	stream_ = nullptr;
+}
+
+size_t http_body::memory_istream::read(char * buf, size_t len)
+{
+	size_t r = 0;
+	while (len && cur != last)
+	{
+		size_t chunk = (std::min)(len, cur->size());
+		memcpy(buf, cur->data(), chunk);
+		cur->remove_prefix(chunk);
+		if (cur->empty())
+			++cur;
+
+		buf += chunk;
+		len -= chunk;
+		r += chunk;
+	}
+
+	return r;
+}
+
 namespace {
 
 struct fixed_req_stream final
@@ -112,113 +330,81 @@ private:
 
 }
 
-static bool load_num(uint64_t & num, std::string_view str)
+void http_server(istream & in, ostream & out, std::function<response(request &&)> const & fn, http2_options const & h2opts)
 {
-	if (str.empty())
-		return false;
-
-	uint64_t r = 0;
-	while (!str.empty())
-	{
-		char ch = str[0];
-		if ('0' > ch || ch > '9')
-			return false;
-
-		uint64_t new_r = r * 10 + (ch - '0');
-		if (new_r < r)
-			return false;
-
-		r = new_r;
-		str.remove_prefix(1);
-	}
-
-	num = r;
-	return true;
+	http_server(in, out, fn, h2opts, {});
 }
 
-void http_server(istream & in, ostream & out, std::function<response(request &&)> const & fn)
+void http_server(istream & in, ostream & out, std::function<response(request &&)> const & fn, http2_options const & h2opts,
+	std::string_view buffered, http_connection_info const * info)
 {
 	char header_buf[64 * 1024];
 	char write_buf[64 * 1024];
-	char const * cur = header_buf;
 	char * last = header_buf;
 	char const * const end = header_buf + sizeof header_buf;
 
-	auto preload = [&]() {
-		if (cur == last)
-		{
-			if (last == end)
-				return false;
-
-			size_t r = in.read(last, end - last);
-			assert(r <= size_t(end - last));
-			last += r;
-
-			if (r == 0)
-				return false;
-		}
-
-		return true;
-	};
+	if (buffered.size() > sizeof header_buf)
+		throw std::length_error("too much buffered input");
 
-	auto consume = [&](char ch) {
-		if (!preload() || *cur != ch)
-			return false;
-		++cur;
-		return true;
-	};
+	if (!buffered.empty())
+	{
+		memcpy(header_buf, buffered.data(), buffered.size());
+		last += buffered.size();
+	}
 
-	auto parse_until = [&](std::string_view & r, char sep) {
-		auto first = cur;
-		while (preload() && *cur != sep)
-			++cur;
-		if (first == last)
-			return false;
-		r = std::string_view(first, cur);
-		++cur;
-		return true;
-	};
+	// Per-connection state reused by every request on the connection;
+	// headers, body streams and handler scratch memory live in the arena.
+	char arena_buf[8 * 1024];
+	http_arena arena(arena_buf, sizeof arena_buf);
+	std::string head;
 
-	auto send_response = [&](response resp) {
-		if (resp.body == nullptr)
-			resp.content_length = 0;
+	vectored_ostream * vout = dynamic_cast<vectored_ostream *>(&out);
 
-		if (resp.content_length != -1)
-			resp.headers.push_back({ "content-length", std::to_string(resp.content_length) });
-		else
-			resp.headers.push_back({ "transfer-encoding", "chunked" });
+	auto write_all_vec = [&](std::string_view * bufs, size_t count) {
+		if (!vout)
+		{
+			for (size_t i = 0; i != count; ++i)
+				out.write_all(bufs[i].data(), bufs[i].size());
+			return;
+		}
 
-		std::string status_code = std::to_string(resp.status_code);
-		if (resp.status_text.empty())
+		while (count)
 		{
-			resp.status_text = "No Status Text";
-			for (auto const & kv : status_texts)
+			size_t r = vout->write_vec(bufs, count);
+			while (count && r >= bufs->size())
 			{
-				if (resp.status_code == kv.first)
-				{
-					resp.status_text = kv.second;
-					break;
-				}
+				r -= bufs->size();
+				++bufs;
+				--count;
 			}
+
+			if (count)
+				bufs->remove_prefix(r);
 		}
+	};
 
-		std::cerr << " " << status_code << "\n";
+	auto send_response = [&](response resp) {
+		head.clear();
+		format_response_head(head, resp);
+
+		std::cerr << " " << resp.status_code << "\n";
 
-		out.write_all("HTTP/1.1 ", 9);
-		out.write_all(status_code.data(), status_code.size());
-		out.write_all(" ", 1);
-		out.write_all(resp.status_text.data(), resp.status_text.size());
-		out.write_all("\r\n", 2);
-		for (auto const & header : resp.headers)
+		size_t slice_count;
+		std::string_view const * slices = resp.body.slices(slice_count);
+		if (slices && resp.content_length == resp.body.size())
 		{
-			out.write_all(header.name.data(), header.name.size());
-			out.write_all(":", 1);
-			out.write_all(header.value.data(), header.value.size());
-			out.write_all("\r\n", 2);
+			// In-memory bodies go out directly along with the head.
+			std::string_view iov[64];
+			response_gather gather(head, slices, slice_count);
+			while (size_t iov_len = gather.next(iov, sizeof iov / sizeof iov[0]))
+				write_all_vec(iov, iov_len);
+
+			return;
 		}
-		out.write_all("\r\n", 2);
 
-		if (resp.content_length != -1)
+		out.write_all(head.data(), head.size());
+
+		if (resp.content_length != http_body::unknown_size)
 		{
 			while (resp.content_length)
 			{
@@ -243,18 +429,9 @@ void http_server(istream & in, ostream & out, std::function<response(request &&)
 					break;
 				}
 
-				char chunk_header[16];
-				size_t chunk_header_len = 0;
-				for (size_t tmp = chunk; tmp; tmp >>= 4)
-				{
-					static char const digits[] = "0123456789abcdef";
-					chunk_header[chunk_header_len++] = digits[tmp & 0xf];
-				}
-
-				std::reverse(chunk_header, chunk_header + chunk_header_len);
-
+				char chunk_header[20];
+				size_t chunk_header_len = format_chunk_header(chunk_header, chunk);
 				out.write_all(chunk_header, chunk_header_len);
-				out.write_all("\r\n", 2);
 
 				out.write_all(write_buf, chunk);
 				out.write_all("\r\n", 2);
@@ -262,103 +439,100 @@ void http_server(istream & in, ostream & out, std::function<response(request &&)
 		}
 	};
 
-	for (;;)
+	// Clients that know the server speaks HTTP/2 start with its preface
+	// right away.
+	while (size_t(last - header_buf) < http2_client_preface_size
+		&& memcmp(header_buf, http2_client_preface, last - header_buf) == 0)
 	{
-		cur = header_buf;
+		size_t r = in.read(last, end - last);
+		if (r == 0)
+			break;
+		last += r;
+	}
 
-		request req;
+	if (size_t(last - header_buf) >= http2_client_preface_size
+		&& memcmp(header_buf, http2_client_preface, http2_client_preface_size) == 0)
+	{
+		http2_server(in, out, fn, h2opts, { header_buf, size_t(last - header_buf) }, info);
+		return;
+	}
 
-		auto parse_headers = [&] {
-			std::string_view version;
-			if (
-				!parse_until(req.method, ' ')
-				|| !parse_until(req.path, ' ')
-				|| !parse_until(version, '\r')
-				|| !consume('\n'))
-			{
-				return false;
-			}
+	std::string h2_settings;
 
-			if (version != "HTTP/1.1")
-				return false;
+	for (;;)
+	{
+		arena.reset();
 
-			std::string_view line;
-			while (parse_until(line, '\r') && consume('\n'))
+		size_t scanned = 0;
+		size_t head_len;
+		while ((head_len = find_request_head({ header_buf, size_t(last - header_buf) }, scanned)) == 0)
+		{
+			if (last == end)
 			{
-				if (line.empty())
-					return true;
-
-				size_t colon_pos = line.find(':');
-				if (colon_pos == std::string_view::npos)
-					return false;
-
-				header_view hv;
-				hv.name = line.substr(0, colon_pos);
-				hv.value = strip(line.substr(colon_pos + 1));
-				req.headers.push_back(hv);
+				send_response(413);
+				return;
 			}
 
-			return false;
-		};
-
-		if (!parse_headers())
-		{
-			if (last != header_buf)
+			size_t r = in.read(last, end - last);
+			assert(r <= size_t(end - last));
+			if (r == 0)
 			{
-				if (last == header_buf + sizeof header_buf)
-					send_response(413);
-				else
+				if (last != header_buf)
 					send_response(400);
+				return;
 			}
 
-			return;
+			last += r;
 		}
 
-		std::sort(req.headers.begin(), req.headers.end());
+		request req;
+		req.arena = &arena;
+		req.connection = info;
+		req.headers = header_list(&arena);
+		req.headers.reserve(32);
 
-		std::string_view prebuf(cur, last);
+		if (!parse_request_head(req, { header_buf, head_len }))
+		{
+			send_response(400);
+			return;
+		}
 
-		bool has_body =
-			req.method == std::string_view("POST")
-			|| req.method == "PUT";
+		std::string_view prebuf(header_buf + head_len, last - header_buf - head_len);
 
-		std::shared_ptr<istream> body;
+		istream * body = nullptr;
 
-		if (!has_body)
+		uint64_t content_length = 0;
+		body_kind kind = get_body_kind(req, content_length);
+		switch (kind)
 		{
-			body = std::make_shared<fixed_req_stream>(prebuf, in, 0);
+		case body_kind::none:
+			body = arena.make<fixed_req_stream>(prebuf, in, 0);
+			break;
+		case body_kind::fixed:
+			body = arena.make<fixed_req_stream>(prebuf, in, content_length);
+			break;
+		case body_kind::chunked:
+			body = arena.make<chunked_req_stream>(prebuf, in);
+			break;
+		case body_kind::invalid:
+			send_response(400);
+			return;
 		}
-		else
-		{
-			if (std::string_view const * cl = get_single(req.headers, "content-length"))
-			{
-				uint64_t content_length;
-				if (load_num(content_length, *cl))
-					body = std::make_shared<fixed_req_stream>(prebuf, in, content_length);
-			}
-
-			if (!body)
-			{
-				bool chunked = false;
-				for (std::string_view tok: enum_headers(req.headers, "transfer-encoding"))
-				{
-					if (chunked || tok != "chunked")
-					{
-						send_response(400);
-						return;
-					}
 
-					chunked = true;
-				}
+		// Requests with a body are served over HTTP/1.1, the upgrade is
+		// optional for the server.
+		if (kind == body_kind::none && get_h2c_upgrade(req, h2_settings))
+		{
+			static char const switching[] = "HTTP/1.1 101 Switching Protocols\r\nconnection:Upgrade\r\nupgrade:h2c\r\n\r\n";
+			out.write_all(switching, sizeof switching - 1);
 
-				if (chunked)
-					body = std::make_shared<chunked_req_stream>(prebuf, in);
-				else
-					body = std::make_shared<fixed_req_stream>(prebuf, in, 0);
-			}
+			http2_server(in, out, fn, h2opts, prebuf, info, &req, h2_settings);
+			return;
 		}
 
-		req.body = body;
+		// The body stream is owned by the arena and is only valid until
+		// the handler returns.
+		req.body = http_body(*body);
 
 		std::cerr << req.path << std::flush;
 
@@ -0,0 +1,119 @@
+#include "http_stop_token.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct http_stop_token::state
+{
+	std::atomic<bool> stopped{ false };
+
+	// Callbacks are called without the mutex held, so that a slow one
+	// doesn't hold up the registration of others. Unregistering the
+	// callback that is running waits for it to return, unless it is
+	// unregistered by the thread running it.
+	std::mutex mutex;
+	std::condition_variable callback_done;
+	std::vector<std::function<void()> *> callbacks;
+	std::function<void()> * running = nullptr;
+	std::thread::id running_thread;
+};
+
+http_stop_token::http_stop_token() noexcept
+{
+}
+
+http_stop_token::http_stop_token(std::shared_ptr<state> st) noexcept
+	: state_(std::move(st))
+{
+}
+
+bool http_stop_token::stop_requested() const noexcept
+{
+	return state_ && state_->stopped.load();
+}
+
+http_stop_source::http_stop_source()
+	: state_(std::make_shared<http_stop_token::state>())
+{
+}
+
+http_stop_token http_stop_source::token() const noexcept
+{
+	return http_stop_token(state_);
+}
+
+bool http_stop_source::stop_requested() const noexcept
+{
+	return state_->stopped.load();
+}
+
+void http_stop_source::request_stop()
+{
+	std::unique_lock<std::mutex> l(state_->mutex);
+	if (state_->stopped.exchange(true))
+		return;
+
+	state_->running_thread = std::this_thread::get_id();
+	while (!state_->callbacks.empty())
+	{
+		std::function<void()> * fn = state_->callbacks.back();
+		state_->callbacks.pop_back();
+		state_->running = fn;
+		l.unlock();
+
+		try
+		{
+			(*fn)();
+		}
+		catch (...)
+		{
+			l.lock();
+			state_->running = nullptr;
+			state_->callback_done.notify_all();
+			throw;
+		}
+
+		l.lock();
+		state_->running = nullptr;
+		state_->callback_done.notify_all();
+	}
+}
+
+http_stop_callback::http_stop_callback(http_stop_token const & token, std::function<void()> fn)
+	: state_(token.state_), fn_(std::move(fn))
+{
+	if (!state_)
+		return;
+
+	std::unique_lock<std::mutex> l(state_->mutex);
+	if (state_->stopped)
+	{
+		l.unlock();
+		fn_();
+	}
+	else
+	{
+		state_->callbacks.push_back(&fn_);
+	}
+}
+
+http_stop_callback::~http_stop_callback()
+{
+	if (!state_)
+		return;
+
+	std::unique_lock<std::mutex> l(state_->mutex);
+	auto it = std::find(state_->callbacks.begin(), state_->callbacks.end(), &fn_);
+	if (it != state_->callbacks.end())
+	{
+		state_->callbacks.erase(it);
+	}
+	else if (state_->running_thread != std::this_thread::get_id())
+	{
+		while (state_->running == &fn_)
+			state_->callback_done.wait(l);
+	}
+}
@@ -0,0 +1,122 @@
+#include "http_worker_pool.hpp"
+
+namespace {
+
+// The pool and the queue of the current thread, if it is a worker.
+thread_local http_worker_pool const * current_pool = nullptr;
+thread_local size_t current_worker = 0;
+
+}
+
+http_worker_pool::http_worker_pool(size_t threads)
+	: pending_(0), next_queue_(0), stopping_(false)
+{
+	if (threads == 0)
+		threads = std::thread::hardware_concurrency();
+	if (threads == 0)
+		threads = 1;
+
+	for (size_t i = 0; i != threads; ++i)
+		workers_.emplace_back(new worker());
+
+	for (size_t i = 0; i != threads; ++i)
+		workers_[i]->thread = std::thread([this, i] { this->run(i); });
+}
+
+http_worker_pool::~http_worker_pool()
+{
+	{
+		std::lock_guard<std::mutex> l(mutex_);
+		stopping_ = true;
+		ready_.notify_all();
+	}
+
+	for (auto & w : workers_)
+		w->thread.join();
+}
+
+void http_worker_pool::post(std::function<void()> task)
+{
+	if (current_pool == this)
+	{
+		worker & w = *workers_[current_worker];
+		std::lock_guard<std::mutex> l(w.mutex);
+		w.tasks.push_back(std::move(task));
+	}
+	else
+	{
+		size_t idx;
+		{
+			std::lock_guard<std::mutex> l(mutex_);
+			idx = next_queue_++ % workers_.size();
+		}
+
+		worker & w = *workers_[idx];
+		std::lock_guard<std::mutex> l(w.mutex);
+		w.tasks.push_back(std::move(task));
+	}
+
+	// The task is counted only once it is queued, so that a worker that
+	// claims it is sure to find it.
+	std::lock_guard<std::mutex> l(mutex_);
+	++pending_;
+	ready_.notify_one();
+}
+
+// A worker takes the newest task of its own queue, or steals the oldest
+// task of another one.
+bool http_worker_pool::take(size_t self, std::function<void()> & task)
+{
+	for (size_t i = 0; i != workers_.size(); ++i)
+	{
+		worker & w = *workers_[(self + i) % workers_.size()];
+		std::lock_guard<std::mutex> l(w.mutex);
+		if (w.tasks.empty())
+			continue;
+
+		if (i == 0)
+		{
+			task = std::move(w.tasks.back());
+			w.tasks.pop_back();
+		}
+		else
+		{
+			task = std::move(w.tasks.front());
+			w.tasks.pop_front();
+		}
+		return true;
+	}
+
+	return false;
+}
+
+void http_worker_pool::run(size_t self)
+{
+	current_pool = this;
+	current_worker = self;
+
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> l(mutex_);
+			while (!stopping_ && pending_ == 0)
+				ready_.wait(l);
+			if (pending_ == 0)
+				return;
+			--pending_;
+		}
+
+		// A task was claimed, it is in one of the queues.
+		std::function<void()> task;
+		while (!this->take(self, task))
+			std::this_thread::yield();
+
+		try
+		{
+			task();
+		}
+		catch (...)
+		{
+		}
+	}
+}
@@ -0,0 +1,397 @@
+#include "http_coro.hpp"
+
+#ifndef _WIN32
+
+#include <algorithm>
+#include <exception>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <system_error>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+struct io_reactor::impl
+{
+	struct waiter
+	{
+		int fd;
+		short events;
+		std::coroutine_handle<> h;
+	};
+
+	struct timer
+	{
+		std::chrono::steady_clock::time_point deadline;
+		std::coroutine_handle<> h;
+	};
+
+	std::mutex mutex;
+
+	// Registered since `run` last collected them.
+	std::vector<waiter> waiters;
+	std::vector<timer> timers;
+	std::vector<std::coroutine_handle<>> posted;
+	bool stopped = false;
+
+	// The error that ended an accept loop, rethrown from `run`.
+	std::exception_ptr error;
+
+	// Set while `run` is blocked in poll, new waiters must wake it.
+	bool polling = false;
+	int wake_pipe[2];
+
+	void wait(int fd, short events, std::coroutine_handle<> h)
+	{
+		std::lock_guard<std::mutex> l(mutex);
+		waiters.push_back({ fd, events, h });
+		if (polling)
+			this->wake();
+	}
+
+	void wake()
+	{
+		char ch = 0;
+		while (::write(wake_pipe[1], &ch, 1) < 0 && errno == EINTR)
+		{
+		}
+	}
+};
+
+namespace {
+
+struct fd_awaiter
+{
+	io_reactor::fd_io & io;
+
+	bool await_ready() noexcept
+	{
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> h)
+	{
+		io.wait_readable(h);
+	}
+
+	void await_resume() noexcept
+	{
+	}
+};
+
+struct delay_awaiter
+{
+	io_reactor & reactor;
+	std::chrono::steady_clock::duration delay;
+
+	bool await_ready() noexcept
+	{
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> h)
+	{
+		reactor.post(h, delay);
+	}
+
+	void await_resume() noexcept
+	{
+	}
+};
+
+void set_nonblocking(int fd)
+{
+	int flags = ::fcntl(fd, F_GETFL);
+	if (flags < 0 || ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		throw std::system_error(errno, std::system_category());
+}
+
+task<void> serve_connection(io_reactor & reactor, int fd, std::function<task<response>(co_request &&)> fn)
+{
+	io_reactor::fd_io io(reactor, fd);
+
+	try
+	{
+		co_await co_http_server(io, std::move(fn));
+	}
+	catch (...)
+	{
+	}
+
+	::close(fd);
+}
+
+task<void> accept_loop(io_reactor & reactor, int fd, std::function<task<response>(co_request &&)> fn)
+{
+	io_reactor::fd_io listener(reactor, fd);
+
+	for (;;)
+	{
+		int conn = ::accept(fd, nullptr, nullptr);
+		if (conn < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				co_await fd_awaiter{ listener };
+			}
+			else if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+			{
+				// The pending connection stays queued, it is accepted once
+				// other connections have closed.
+				co_await delay_awaiter{ reactor, std::chrono::milliseconds(100) };
+			}
+			else if (errno != EINTR && errno != ECONNABORTED)
+			{
+				throw std::system_error(errno, std::system_category());
+			}
+			continue;
+		}
+
+		set_nonblocking(conn);
+		spawn(serve_connection(reactor, conn, fn));
+	}
+}
+
+}
+
+io_reactor::fd_io::fd_io(io_reactor & reactor, int fd)
+	: reactor_(reactor), fd_(fd)
+{
+}
+
+size_t io_reactor::fd_io::try_read(char * buf, size_t len)
+{
+	for (;;)
+	{
+		ssize_t r = ::read(fd_, buf, len);
+		if (r >= 0)
+			return r;
+
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return would_block;
+		if (errno != EINTR)
+			throw std::system_error(errno, std::system_category());
+	}
+}
+
+size_t io_reactor::fd_io::try_write(char const * buf, size_t len)
+{
+	for (;;)
+	{
+		ssize_t r = ::send(fd_, buf, len, MSG_NOSIGNAL);
+		if (r < 0 && errno == ENOTSOCK)
+			r = ::write(fd_, buf, len);
+
+		if (r >= 0)
+			return r;
+
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return would_block;
+		if (errno != EINTR)
+			throw std::system_error(errno, std::system_category());
+	}
+}
+
+size_t io_reactor::fd_io::try_write_vec(std::string_view const * bufs, size_t count)
+{
+	iovec iov[64];
+	if (count > sizeof iov / sizeof iov[0])
+		count = sizeof iov / sizeof iov[0];
+
+	for (size_t i = 0; i != count; ++i)
+	{
+		iov[i].iov_base = const_cast<char *>(bufs[i].data());
+		iov[i].iov_len = bufs[i].size();
+	}
+
+	msghdr msg = {};
+	msg.msg_iov = iov;
+	msg.msg_iovlen = count;
+
+	for (;;)
+	{
+		ssize_t r = ::sendmsg(fd_, &msg, MSG_NOSIGNAL);
+		if (r < 0 && errno == ENOTSOCK)
+			r = ::writev(fd_, iov, (int)count);
+
+		if (r >= 0)
+			return r;
+
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return would_block;
+		if (errno != EINTR)
+			throw std::system_error(errno, std::system_category());
+	}
+}
+
+void io_reactor::fd_io::wait_readable(std::coroutine_handle<> h)
+{
+	reactor_.pimpl_->wait(fd_, POLLIN, h);
+}
+
+void io_reactor::fd_io::wait_writable(std::coroutine_handle<> h)
+{
+	reactor_.pimpl_->wait(fd_, POLLOUT, h);
+}
+
+io_reactor::io_reactor()
+	: pimpl_(new impl())
+{
+	if (::pipe(pimpl_->wake_pipe) < 0)
+		throw std::system_error(errno, std::system_category());
+
+	set_nonblocking(pimpl_->wake_pipe[0]);
+	set_nonblocking(pimpl_->wake_pipe[1]);
+}
+
+io_reactor::~io_reactor()
+{
+	::close(pimpl_->wake_pipe[0]);
+	::close(pimpl_->wake_pipe[1]);
+}
+
+void io_reactor::serve(int fd, std::function<task<response>(co_request &&)> fn)
+{
+	auto listen = [](io_reactor & reactor, int fd, std::function<task<response>(co_request &&)> fn) -> task<void> {
+		try
+		{
+			co_await accept_loop(reactor, fd, std::move(fn));
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> l(reactor.pimpl_->mutex);
+			if (!reactor.pimpl_->error)
+				reactor.pimpl_->error = std::current_exception();
+			reactor.pimpl_->wake();
+		}
+	};
+
+	spawn(listen(*this, fd, std::move(fn)));
+}
+
+void io_reactor::post(std::coroutine_handle<> h)
+{
+	std::lock_guard<std::mutex> l(pimpl_->mutex);
+	pimpl_->posted.push_back(h);
+	pimpl_->wake();
+}
+
+void io_reactor::post(std::coroutine_handle<> h, std::chrono::steady_clock::duration delay)
+{
+	std::lock_guard<std::mutex> l(pimpl_->mutex);
+	pimpl_->timers.push_back({ std::chrono::steady_clock::now() + delay, h });
+	if (pimpl_->polling)
+		pimpl_->wake();
+}
+
+void io_reactor::stop()
+{
+	std::lock_guard<std::mutex> l(pimpl_->mutex);
+	pimpl_->stopped = true;
+	pimpl_->wake();
+}
+
+void io_reactor::run()
+{
+	std::vector<pollfd> fds;
+	std::vector<impl::waiter> waiters;
+	std::vector<impl::timer> timers;
+	std::vector<std::coroutine_handle<>> ready;
+	std::vector<std::coroutine_handle<>> posted;
+
+	for (;;)
+	{
+		{
+			std::lock_guard<std::mutex> l(pimpl_->mutex);
+			if (pimpl_->error)
+				std::rethrow_exception(std::exchange(pimpl_->error, nullptr));
+			if (pimpl_->stopped)
+				return;
+			posted.swap(pimpl_->posted);
+		}
+
+		for (auto h : posted)
+			h.resume();
+		posted.clear();
+
+		{
+			std::lock_guard<std::mutex> l(pimpl_->mutex);
+			waiters.insert(waiters.end(), pimpl_->waiters.begin(), pimpl_->waiters.end());
+			pimpl_->waiters.clear();
+			timers.insert(timers.end(), pimpl_->timers.begin(), pimpl_->timers.end());
+			pimpl_->timers.clear();
+			pimpl_->polling = true;
+		}
+
+		fds.clear();
+		fds.push_back({ pimpl_->wake_pipe[0], POLLIN, 0 });
+		for (auto const & w : waiters)
+			fds.push_back({ w.fd, w.events, 0 });
+
+		// Sleeps until the earliest timer expires, rounded up to whole
+		// milliseconds.
+		int timeout = -1;
+		if (!timers.empty())
+		{
+			auto deadline = std::min_element(timers.begin(), timers.end(), [](impl::timer const & a, impl::timer const & b) {
+				return a.deadline < b.deadline;
+			})->deadline;
+
+			auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+			timeout = int((std::max)(left, decltype(left)(0)));
+		}
+
+		int r = ::poll(fds.data(), fds.size(), timeout);
+
+		{
+			std::lock_guard<std::mutex> l(pimpl_->mutex);
+			pimpl_->polling = false;
+		}
+
+		if (r < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			throw std::system_error(errno, std::system_category());
+		}
+
+		if (fds[0].revents)
+		{
+			char buf[64];
+			while (::read(pimpl_->wake_pipe[0], buf, sizeof buf) > 0)
+			{
+			}
+		}
+
+		size_t keep = 0;
+		for (size_t i = 0; i != waiters.size(); ++i)
+		{
+			if (fds[i + 1].revents)
+				ready.push_back(waiters[i].h);
+			else
+				waiters[keep++] = waiters[i];
+		}
+		waiters.resize(keep);
+
+		auto now = std::chrono::steady_clock::now();
+		keep = 0;
+		for (size_t i = 0; i != timers.size(); ++i)
+		{
+			if (timers[i].deadline <= now)
+				ready.push_back(timers[i].h);
+			else
+				timers[keep++] = timers[i];
+		}
+		timers.resize(keep);
+
+		for (auto h : ready)
+			h.resume();
+		ready.clear();
+	}
+}
+
+#endif
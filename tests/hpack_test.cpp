@@ -0,0 +1,96 @@
+#include "hpack.hpp"
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Encodes header lists and checks that they decode to the same fields.
+// The tables are small, so that entries are evicted while their names are
+// still being reused.
+
+using field_list = std::vector<std::pair<std::string, std::string>>;
+
+static bool round_trip(hpack_encoder & enc, hpack_decoder & dec, field_list const & fields)
+{
+	std::string block;
+	enc.begin_block(block);
+	for (auto const & f : fields)
+		enc.encode(block, f.first, f.second);
+
+	http_arena arena;
+	header_list headers(&arena);
+	if (!dec.decode(headers, block, true, arena) || headers.size() != fields.size())
+		return false;
+
+	for (size_t i = 0; i != fields.size(); ++i)
+	{
+		if (headers[i].name != fields[i].first || headers[i].value != fields[i].second)
+			return false;
+	}
+
+	return true;
+}
+
+int main()
+{
+	int failures = 0;
+	auto check = [&](char const * name, bool ok) {
+		if (!ok)
+		{
+			std::cout << "FAILED: " << name << "\n";
+			++failures;
+		}
+	};
+
+	{
+		hpack_encoder enc(200);
+		hpack_decoder dec(200);
+
+		bool ok = true;
+		for (int i = 0; i != 20; ++i)
+			ok = round_trip(enc, dec, { { "x-custom-header-name", "value-" + std::to_string(i) } }) && ok;
+		check("reused name with eviction", ok);
+	}
+
+	{
+		hpack_encoder enc(200);
+		hpack_decoder dec(200);
+
+		bool ok = true;
+		for (int i = 0; i != 50; ++i)
+		{
+			field_list fields = {
+				{ "x-custom-header-name", "value-" + std::to_string(i % 7) },
+				{ "x-other", std::to_string(i % 3) },
+				{ "x-custom-header-name", "value-" + std::to_string(i % 5) },
+			};
+			ok = round_trip(enc, dec, fields) && ok;
+		}
+		check("repeated fields with eviction", ok);
+	}
+
+	{
+		hpack_encoder enc(4096);
+		hpack_decoder dec(4096);
+
+		bool ok = round_trip(enc, dec, { { ":method", "GET" }, { ":path", "/" }, { "user-agent", "test" } });
+		enc.set_max_capacity(64);
+		ok = round_trip(enc, dec, { { "user-agent", "test" }, { "x-long", std::string(100, 'a') } }) && ok;
+		ok = round_trip(enc, dec, { { "user-agent", "test" } }) && ok;
+		check("capacity change", ok);
+	}
+
+	{
+		// An indexed field whose index continues with a long run of zeros.
+		std::string block = "\xff";
+		block.append(20, '\x80');
+		block += '\x01';
+
+		hpack_decoder dec(4096);
+		http_arena arena;
+		header_list headers(&arena);
+		check("integer with a long continuation", !dec.decode(headers, block, true, arena));
+	}
+
+	return failures == 0? 0: 1;
+}
@@ -0,0 +1,237 @@
+#include "http2_connection.hpp"
+#include "http2_frame.hpp"
+#include "hpack.hpp"
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Feeds hand-made frames to a connection and checks the frames it answers
+// with.
+
+using field_list = std::vector<std::pair<std::string, std::string>>;
+
+struct frame
+{
+	frame_type type;
+	char flags;
+	uint32_t stream_id;
+	std::string payload;
+};
+
+static std::string make_frame(frame_type type, char flags, uint32_t stream_id, std::string_view payload)
+{
+	char header[9];
+	store_be(header, uint32_t(payload.size()), 3);
+	header[3] = char(type);
+	header[4] = flags;
+	store_be(header + 5, stream_id);
+	return std::string(header, sizeof header) + std::string(payload);
+}
+
+static std::string make_headers(hpack_encoder & enc, char flags, uint32_t stream_id, field_list const & fields)
+{
+	std::string block;
+	enc.begin_block(block);
+	for (auto const & f : fields)
+		enc.encode(block, f.first, f.second);
+	return make_frame(frame_type::headers, flags | frame_flags::end_headers, stream_id, block);
+}
+
+static field_list post_request(std::string path)
+{
+	return {
+		{ ":method", "POST" },
+		{ ":scheme", "http" },
+		{ ":authority", "localhost" },
+		{ ":path", std::move(path) },
+	};
+}
+
+static void feed(http2_connection & conn, std::string const & data)
+{
+	conn.feed(data.data(), data.size());
+}
+
+static std::string start()
+{
+	return std::string(http2_client_preface, http2_client_preface_size) + make_frame(frame_type::settings, 0, 0, {});
+}
+
+static std::vector<frame> take_output(http2_connection & conn)
+{
+	std::string out;
+	while (conn.has_output())
+	{
+		std::string_view bufs[16];
+		size_t count = conn.output(bufs, 16);
+
+		size_t len = 0;
+		for (size_t i = 0; i != count; ++i)
+		{
+			out.append(bufs[i].data(), bufs[i].size());
+			len += bufs[i].size();
+		}
+		conn.consume_output(len);
+	}
+
+	std::vector<frame> r;
+	std::string_view rest = out;
+	while (rest.size() >= 9)
+	{
+		size_t len = load_be<uint32_t>(rest.data(), 3);
+		r.push_back({ frame_type(rest[3]), rest[4], load_be<uint32_t>(rest.data() + 5) & 0x7fffffff, std::string(rest.substr(9, len)) });
+		rest.remove_prefix(9 + len);
+	}
+	return r;
+}
+
+static bool has_frame(std::vector<frame> const & frames, frame_type type, uint32_t stream_id)
+{
+	for (auto const & f : frames)
+	{
+		if (f.type == type && f.stream_id == stream_id)
+			return true;
+	}
+
+	return false;
+}
+
+static std::string read_body(http2_connection & conn, uint32_t stream_id)
+{
+	std::string r;
+	char buf[64];
+	while (size_t len = conn.read_body(stream_id, buf, sizeof buf))
+		r.append(buf, len);
+	return r;
+}
+
+int main()
+{
+	int failures = 0;
+	auto check = [&](char const * name, bool ok) {
+		if (!ok)
+		{
+			std::cout << "FAILED: " << name << "\n";
+			++failures;
+		}
+	};
+
+	{
+		http2_connection conn;
+		hpack_encoder enc;
+
+		std::string in = start();
+		in += make_headers(enc, 0, 1, post_request("/upload"));
+		in += make_frame(frame_type::data, 0, 1, "hello");
+		in += make_headers(enc, frame_flags::end_stream, 1, { { "x-checksum", "5d41402a" } });
+
+		// The trailers are indexed by the encoder, the decoder must have
+		// kept up for this block to decode.
+		field_list second = post_request("/again");
+		second.emplace_back("x-checksum", "5d41402a");
+		in += make_headers(enc, frame_flags::end_stream, 3, second);
+
+		bool ok = true;
+		try
+		{
+			feed(conn, in);
+		}
+		catch (http2_connection_error const &)
+		{
+			ok = false;
+		}
+
+		uint32_t stream_id = 0;
+		request req;
+		ok = ok && conn.next_request(stream_id, req) && stream_id == 1;
+		ok = ok && read_body(conn, 1) == "hello" && conn.body_complete(1);
+		if (ok)
+			conn.submit_response(1, response("ok"));
+
+		ok = ok && conn.next_request(stream_id, req) && stream_id == 3;
+		if (ok)
+			conn.submit_response(3, response("ok"));
+
+		std::vector<frame> out = take_output(conn);
+		ok = ok && has_frame(out, frame_type::headers, 1) && has_frame(out, frame_type::headers, 3);
+		ok = ok && !has_frame(out, frame_type::rst_stream, 1) && !has_frame(out, frame_type::goaway, 0);
+		check("request trailers", ok);
+	}
+
+	{
+		http2_connection conn;
+		hpack_encoder enc;
+
+		std::string in = start();
+		in += make_headers(enc, 0, 1, post_request("/upload"));
+		in += make_headers(enc, 0, 1, { { "x-checksum", "5d41402a" } });
+
+		bool ok = true;
+		try
+		{
+			feed(conn, in);
+		}
+		catch (http2_connection_error const &)
+		{
+			ok = false;
+		}
+
+		ok = ok && has_frame(take_output(conn), frame_type::rst_stream, 1);
+		check("trailers without END_STREAM", ok);
+	}
+
+	{
+		http2_connection conn;
+		hpack_encoder enc;
+
+		std::string in = start();
+		in += make_headers(enc, frame_flags::end_stream, 3, post_request("/upload"));
+		in += make_headers(enc, frame_flags::end_stream, 1, { { "x-checksum", "5d41402a" } });
+
+		bool ok = false;
+		try
+		{
+			feed(conn, in);
+		}
+		catch (http2_connection_error const & e)
+		{
+			ok = e.code == uint32_t(error_code::protocol_error);
+		}
+
+		check("headers on a closed stream", ok);
+	}
+
+	{
+		http2_options opts;
+		opts.max_buffered_body = 16384;
+		http2_connection conn(opts);
+		hpack_encoder enc;
+
+		std::string in = start();
+		in += make_headers(enc, 0, 1, post_request("/first"));
+		in += make_headers(enc, 0, 3, post_request("/second"));
+		for (int i = 0; i != 4; ++i)
+			in += make_frame(frame_type::data, 0, 3, std::string(15000, 'x'));
+		feed(conn, in);
+
+		// The body of the second request is over the limit, the connection
+		// window is held back.
+		bool ok = !has_frame(take_output(conn), frame_type::window_update, 0);
+
+		// Until the first handler waits for its body, the second request
+		// is then refused.
+		uint32_t stream_id = 0;
+		request req;
+		char buf[16];
+		ok = ok && conn.next_request(stream_id, req) && stream_id == 1;
+		ok = ok && conn.read_body(1, buf, sizeof buf) == 0;
+
+		std::vector<frame> out = take_output(conn);
+		ok = ok && has_frame(out, frame_type::rst_stream, 3) && has_frame(out, frame_type::window_update, 0);
+		ok = ok && !conn.next_request(stream_id, req);
+		check("buffered body limit", ok);
+	}
+
+	return failures == 0? 0: 1;
+}
@@ -0,0 +1,94 @@
+#include "http_router.hpp"
+#include <iostream>
+#include <string>
+
+// Checks which handler each path is routed to and what it captures.
+
+static http_router make_router()
+{
+	http_router router;
+
+	auto add = [&](char const * method, char const * pattern, char const * name) {
+		router.add(method, pattern, [name](request &&, route_params const & params) {
+			std::string r = name;
+			for (size_t i = 0; i != params.size(); ++i)
+			{
+				r += ' ';
+				r += std::string(params.name(i));
+				r += '=';
+				r += std::string(params.value(i));
+			}
+			return response(std::move(r));
+		});
+	};
+
+	// Inserted so that the later routes split the prefixes of the earlier ones.
+	add("GET", "/users", "users");
+	add("GET", "/user", "user");
+	add("GET", "/usage", "usage");
+	add("POST", "/users", "create");
+	add("GET", "/users/:id", "show");
+	add("GET", "/users/me", "me");
+	add("GET", "/users/:id/posts/:post", "post");
+	add("GET", "/files/*path", "files");
+	add("PURGE", "/cache", "purge");
+	return router;
+}
+
+static std::string route(http_router const & router, char const * method, char const * path)
+{
+	request req;
+	req.method = method;
+	req.path = path;
+
+	response resp = router(std::move(req));
+	if (resp.status_code != 200)
+		return std::to_string(resp.status_code);
+
+	size_t count;
+	std::string_view const * slices = resp.body.slices(count);
+
+	std::string r;
+	for (size_t i = 0; slices && i != count; ++i)
+		r += std::string(slices[i]);
+	return r;
+}
+
+int main()
+{
+	http_router router = make_router();
+
+	int failures = 0;
+	auto check = [&](char const * method, char const * path, std::string const & expected) {
+		std::string actual = route(router, method, path);
+		if (actual != expected)
+		{
+			std::cout << "FAILED: " << method << " " << path << ": expected \"" << expected << "\", got \"" << actual << "\"\n";
+			++failures;
+		}
+	};
+
+	check("GET", "/users", "users");
+	check("GET", "/user", "user");
+	check("GET", "/usage", "usage");
+	check("POST", "/users", "create");
+	check("GET", "/users?page=2", "users");
+
+	check("GET", "/users/42", "show id=42");
+	check("GET", "/users/me", "me");
+	check("GET", "/users/42/posts/7", "post id=42 post=7");
+	check("GET", "/files/a/b/c.txt", "files path=a/b/c.txt");
+	check("GET", "/files/", "files path=");
+	check("PURGE", "/cache", "purge");
+
+	check("GET", "/use", "404");
+	check("GET", "/users/", "404");
+	check("GET", "/users/42/posts", "404");
+	check("GET", "/nothing", "404");
+
+	check("DELETE", "/users", "405");
+	check("POST", "/users/42", "405");
+	check("GET", "/cache", "405");
+
+	return failures == 0? 0: 1;
+}
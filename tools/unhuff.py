@@ -4,11 +4,25 @@ def get_bin(code, l):
     code = bin(code)[2:]
     return '0'*(l-len(code)) + code
 
+def _print_encoder():
+    for code in codes:
+        print('    {{ 0x{:x}, {} }},'.format(int(code, 2), len(code)))
+
 def _main():
     ap = argparse.ArgumentParser()
-    ap.add_argument('bw', type=int)
+    ap.add_argument('bw', type=int, nargs='?')
+    ap.add_argument('--encoder', action='store_true')
     args = ap.parse_args()
 
+    if args.encoder:
+        _print_encoder()
+        return 0
+
+    if args.bw is None:
+        ap.error('the bit width is required')
+    if 8 % args.bw != 0:
+        ap.error('the bit width must divide 8')
+
     state0 = (frozenset(range(len(codes))), 0)
 
     q = [state0]
@@ -58,25 +72,51 @@ def _main():
     for state, id in state_ids.items():
         states[id] = state
 
-    final_states = set(i for i in range(len(states)) if '0' not in get_prefix(states[i]))
+    # The padding is the prefix of the EOS symbol and shorter than an octet.
+    final_states = set(i for i in range(len(states)) if '0' not in get_prefix(states[i]) and len(get_prefix(states[i])) < 8)
+
+    max_symbols = max(len(dec) for _, dec in table.values())
+
+    print('#include <stdint.h>')
+    print('')
+    print('// Generated by tools/unhuff.py {}.'.format(args.bw))
+    print('')
+    print('enum')
+    print('{')
+    print('\thpack_unhuff_bits = {},'.format(args.bw))
+    print('\thpack_unhuff_max_symbols = {},'.format(max_symbols))
+    print('};')
+    print('')
+    print('// The number of symbols decoded by an entry is stored in the flags.')
+    print('struct hpack_unhuff_entry')
+    print('{')
+    print('\tenum')
+    print('\t{')
+    print('\t\tvalid = 1,')
+    print('\t\tlast = 2,')
+    print('\t\tcount_shift = 2,')
+    print('\t};')
+    print('')
+    print('\tuint8_t flags;')
+    print('\tuint8_t next_state;')
+    print('\tuint8_t values[hpack_unhuff_max_symbols];')
+    print('};')
+    print('')
+    print('static hpack_unhuff_entry const g_hpack_unhuff_table[{}][{}] = {{'.format(len(states), 2**args.bw))
 
     for state_id in range(len(states)):
-        print('{')
+        print('\t{')
         for val in range(2**args.bw):
-            if (state_id, val) not in table:
-                print ('    { 0, 0, 0 },')
-            else:
+            flags, new_state, values = 0, 0, [0]*max_symbols
+            if (state_id, val) in table:
                 new_state, dec = table[state_id, val]
-                flags = 1
-                if not dec:
-                    dec = 0
-                else:
-                    dec = dec[0]
-                    flags += 2
+                flags = 1 + (len(dec) << 2)
                 if new_state in final_states:
-                    flags += 4
-                print ('    {{ {}, {}, {} }},'.format(flags, new_state, dec))
-        print('},')
+                    flags += 2
+                values[:len(dec)] = dec
+            print('\t\t{{ {}, {}, {{ {} }} }},'.format(flags, new_state, ', '.join(str(v) for v in values)))
+        print('\t},')
+    print('};')
 
 codes = [
     ( 0x1ff8, 13),